@@ -0,0 +1,317 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <libavformat/avio.h>
+#include <libavutil/mem.h>
+#include "aio.h"
+#include "draw.h"
+
+#define N_BUFS 8
+#define BUF_SIZE (1 << 20)
+#define BUF_ALIGN 4096
+#define IO_SIZE (64 << 10)
+
+#if LIBAVFORMAT_VERSION_MAJOR < 61
+typedef uint8_t io_buf;
+#else
+typedef const uint8_t io_buf;
+#endif
+
+struct ring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_sqe *sqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+};
+
+struct aio {
+	int fd;
+	struct ring ring;
+	unsigned char *bufs[N_BUFS];
+	size_t lens[N_BUFS];
+	int64_t offs[N_BUFS];
+	int busy[N_BUFS];
+	int n_busy;
+	int cur;
+	size_t fill;
+	int64_t off;
+	int64_t end;
+	int sync;
+};
+
+static int ring_init(struct ring *r, unsigned entries) {
+	struct io_uring_params p;
+	int single;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+	single = p.features & IORING_FEAT_SINGLE_MMAP;
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (single && r->cq_size > r->sq_size)
+		r->sq_size = r->cq_size;
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto err_fd;
+	r->cq_ptr = single ? r->sq_ptr :
+		mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if (r->cq_ptr == MAP_FAILED)
+		goto err_sq;
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto err_cq;
+	r->sq_head = (unsigned *) ((char *) r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *) ((char *) r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *) ((char *) r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *) ((char *) r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *) ((char *) r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *) ((char *) r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *) ((char *) r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)
+		((char *) r->cq_ptr + p.cq_off.cqes);
+	return 0;
+err_cq:
+	if (!single)
+		munmap(r->cq_ptr, r->cq_size);
+err_sq:
+	munmap(r->sq_ptr, r->sq_size);
+err_fd:
+	close(r->fd);
+	r->fd = -1;
+	return -1;
+}
+
+static void ring_free(struct ring *r) {
+	if (r->fd < 0)
+		return;
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+}
+
+static int ring_enter(struct ring *r, unsigned submit, unsigned wait) {
+	return syscall(__NR_io_uring_enter, r->fd, submit, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void write_all(int fd, const unsigned char *buf,
+		size_t len, int64_t off) {
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, off);
+		if (n < 0)
+			die("pwrite: %s\n", strerror(errno));
+		buf += n;
+		len -= n;
+		off += n;
+	}
+}
+
+static int retry(int err) {
+	return err == EINTR || err == EAGAIN || err == EBUSY;
+}
+
+static void complete(struct aio *a, int i, int res) {
+	if (res == -EINVAL || res == -EOPNOTSUPP) {
+		a->sync = 1;
+		res = 0;
+	} else if (res < 0) {
+		die("io_uring write: %s\n", strerror(-res));
+	}
+	if ((size_t) res < a->lens[i])
+		write_all(a->fd, a->bufs[i] + res,
+				a->lens[i] - res, a->offs[i] + res);
+	a->busy[i] = 0;
+	a->n_busy--;
+}
+
+static void reap(struct aio *a, int wait) {
+	struct ring *r;
+	struct io_uring_cqe *cqe;
+	unsigned head;
+
+	r = &a->ring;
+	if (wait && ring_enter(r, 0, 1) < 0 && !retry(errno))
+		die("io_uring_enter: %s\n", strerror(errno));
+	head = *r->cq_head;
+	while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		complete(a, cqe->user_data, cqe->res);
+		head++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void submit(struct aio *a) {
+	struct ring *r;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+	int i, n;
+
+	i = a->cur;
+	if (a->fill == 0)
+		return;
+	a->lens[i] = a->fill;
+	a->offs[i] = a->off;
+	a->off += a->fill;
+	a->fill = 0;
+	r = &a->ring;
+	if (r->fd < 0 || a->sync) {
+		write_all(a->fd, a->bufs[i], a->lens[i], a->offs[i]);
+		return;
+	}
+	tail = *r->sq_tail;
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = a->fd;
+	sqe->addr = (uintptr_t) a->bufs[i];
+	sqe->len = a->lens[i];
+	sqe->off = a->offs[i];
+	sqe->user_data = i;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	while ((n = ring_enter(r, 1, 0)) < 1) {
+		if (n < 0 && !retry(errno))
+			die("io_uring_enter: %s\n", strerror(errno));
+		reap(a, 0);
+	}
+	a->busy[i] = 1;
+	a->n_busy++;
+	while (a->busy[a->cur]) {
+		reap(a, 0);
+		if (a->n_busy < N_BUFS) {
+			for (i = 0; a->busy[i]; i++);
+			a->cur = i;
+		} else {
+			reap(a, 1);
+		}
+	}
+}
+
+static void drain(struct aio *a) {
+	submit(a);
+	while (a->n_busy > 0)
+		reap(a, 1);
+}
+
+static int write_packet(void *opaque, io_buf *buf, int size) {
+	struct aio *a;
+	size_t n;
+	int left;
+
+	a = opaque;
+	left = size;
+	while (left > 0) {
+		n = BUF_SIZE - a->fill;
+		if (n > (size_t) left)
+			n = left;
+		memcpy(a->bufs[a->cur] + a->fill, buf, n);
+		a->fill += n;
+		buf += n;
+		left -= n;
+		if (a->fill == BUF_SIZE)
+			submit(a);
+	}
+	if (a->off + (int64_t) a->fill > a->end)
+		a->end = a->off + a->fill;
+	return size;
+}
+
+static int64_t seek(void *opaque, int64_t off, int whence) {
+	struct aio *a;
+	int64_t pos;
+
+	a = opaque;
+	pos = a->off + a->fill;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return a->end;
+	case SEEK_SET:
+		pos = off;
+		break;
+	case SEEK_CUR:
+		pos += off;
+		break;
+	case SEEK_END:
+		pos = a->end + off;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+	if (pos < 0)
+		return AVERROR(EINVAL);
+	drain(a);
+	a->off = pos;
+	return pos;
+}
+
+AVIOContext *aio_open(const char *path) {
+	struct aio *a;
+	unsigned char *buf;
+	AVIOContext *pb;
+	int i;
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		die("calloc: out of memory\n");
+	a->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (a->fd < 0)
+		die("open: %s: %s\n", path, strerror(errno));
+	for (i = 0; i < N_BUFS; i++) {
+		if (posix_memalign((void **) &a->bufs[i], BUF_ALIGN, BUF_SIZE))
+			die("posix_memalign: out of memory\n");
+	}
+	ring_init(&a->ring, N_BUFS);
+	buf = av_malloc(IO_SIZE);
+	if (!buf)
+		die("av_malloc: out of memory\n");
+	pb = avio_alloc_context(buf, IO_SIZE, 1, a, NULL, write_packet, seek);
+	if (!pb)
+		die("avio_alloc_context\n");
+	return pb;
+}
+
+void aio_close(AVIOContext **pb) {
+	struct aio *a;
+	int i;
+
+	avio_flush(*pb);
+	a = (*pb)->opaque;
+	drain(a);
+	ring_free(&a->ring);
+	if (close(a->fd) < 0)
+		die("close: %s\n", strerror(errno));
+	for (i = 0; i < N_BUFS; i++)
+		free(a->bufs[i]);
+	free(a);
+	av_freep(&(*pb)->buffer);
+	avio_context_free(pb);
+}
@@ -0,0 +1,9 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <libavformat/avio.h>
+
+AVIOContext *aio_open(const char *path);
+void aio_close(AVIOContext **pb);
+
+#endif
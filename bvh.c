@@ -0,0 +1,200 @@
+#include <math.h>
+#include <stdlib.h>
+#include "bvh.h"
+#include "draw.h"
+#include "kern.h"
+
+#define LEAF_SIZE 4
+#define MAX_DEPTH 64
+
+struct bvh_node {
+	struct vec2 min;
+	struct vec2 max;
+	int first;
+	int count;
+};
+
+static struct segment *segs;
+static const struct segment **near;
+static struct bvh_node *nodes;
+static int n_nodes;
+static int sort_axis;
+
+static float centroid(const struct segment *s, int axis) {
+	return axis ? s->a.y + s->ab.y * 0.5F : s->a.x + s->ab.x * 0.5F;
+}
+
+static int cmp_id(const void *a, const void *b) {
+	const struct segment *const *s, *const *t;
+
+	s = a;
+	t = b;
+	return (*s)->id - (*t)->id;
+}
+
+static int cmp_centroid(const void *a, const void *b) {
+	float ca, cb;
+
+	ca = centroid(a, sort_axis);
+	cb = centroid(b, sort_axis);
+	return (ca > cb) - (ca < cb);
+}
+
+static void grow_box(struct bvh_node *n, float x, float y) {
+	n->min.x = fminf(n->min.x, x);
+	n->min.y = fminf(n->min.y, y);
+	n->max.x = fmaxf(n->max.x, x);
+	n->max.y = fmaxf(n->max.y, y);
+}
+
+static int build(int first, int count, int depth) {
+	struct bvh_node *n;
+	const struct segment *s;
+	int i, half;
+
+	i = n_nodes++;
+	n = &nodes[i];
+	n->min.x = n->min.y = INFINITY;
+	n->max.x = n->max.y = -INFINITY;
+	for (s = &segs[first]; s < &segs[first + count]; s++) {
+		grow_box(n, s->a.x, s->a.y);
+		grow_box(n, s->a.x + s->ab.x, s->a.y + s->ab.y);
+	}
+	if (count <= LEAF_SIZE || depth == MAX_DEPTH - 1) {
+		n->first = first;
+		n->count = count;
+		return i;
+	}
+	sort_axis = n->max.y - n->min.y > n->max.x - n->min.x;
+	qsort(&segs[first], count, sizeof(*segs), cmp_centroid);
+	half = count / 2;
+	build(first, half, depth + 1);
+	n = &nodes[i];
+	n->first = build(first + half, count - half, depth + 1);
+	n->count = 0;
+	return i;
+}
+
+void bvh_build(const struct table *t) {
+	const struct polyline *l;
+	int i, n;
+
+	n = 0;
+	for (l = t->lines; l < t->lines + t->n_lines; l++)
+		n += line_segments(l);
+	free(segs);
+	free(near);
+	free(nodes);
+	segs = malloc(n * sizeof(*segs));
+	near = malloc(n * sizeof(*near));
+	nodes = malloc(2 * n * sizeof(*nodes));
+	if (!segs || !near || !nodes)
+		die("malloc: out of memory\n");
+	n = 0;
+	for (l = t->lines; l < t->lines + t->n_lines; l++) {
+		for (i = 0; i < line_segments(l); i++) {
+			make_segment(&segs[n], t->border, l, i, n);
+			n++;
+		}
+	}
+	n_nodes = 0;
+	build(0, n, 0);
+}
+
+static float box_dist(const struct bvh_node *n, struct vec2 p) {
+	float dx, dy;
+
+	dx = fmaxf(fmaxf(n->min.x - p.x, p.x - n->max.x), 0.0F);
+	dy = fmaxf(fmaxf(n->min.y - p.y, p.y - n->max.y), 0.0F);
+	return dx * dx + dy * dy;
+}
+
+static void query(struct seg_hit *h, struct vec2 p) {
+	const struct bvh_node *n;
+	int stack[MAX_DEPTH];
+	int sp, i, near, far;
+
+	sp = 0;
+	stack[sp++] = 0;
+	while (sp) {
+		n = &nodes[stack[--sp]];
+		if (box_dist(n, p) > h->min_dist)
+			continue;
+		if (n->count) {
+			for (i = n->first; i < n->first + n->count; i++)
+				seg_test(h, p, &segs[i]);
+			continue;
+		}
+		near = n - nodes + 1;
+		far = n->first;
+		if (box_dist(&nodes[far], p) < box_dist(&nodes[near], p)) {
+			far = near;
+			near = n->first;
+		}
+		stack[sp++] = far;
+		stack[sp++] = near;
+	}
+}
+
+void bvh_border(const struct ball *b, int i, float dt) {
+	const struct bvh_node *n;
+	int stack[MAX_DEPTH];
+	float reach2;
+	int sp, k, n_near;
+
+	reach2 = border_reach(b, dt);
+	n_near = 0;
+	sp = 0;
+	stack[sp++] = 0;
+	while (sp) {
+		n = &nodes[stack[--sp]];
+		if (box_dist(n, b->pos) >= reach2)
+			continue;
+		if (n->count) {
+			for (k = n->first; k < n->first + n->count; k++)
+				near[n_near++] = &segs[k];
+			continue;
+		}
+		stack[sp++] = n->first;
+		stack[sp++] = n - nodes + 1;
+	}
+	qsort(near, n_near, sizeof(*near), cmp_id);
+	for (k = 0; k < n_near; k++)
+		seg_border(b, i, reach2, near[k]);
+}
+
+float bvh_distance(struct vec2 p) {
+	struct seg_hit h;
+
+	h.min_dist = INFINITY;
+	h.id = INT_MAX;
+	query(&h, p);
+	return sqrtf(h.min_dist);
+}
+
+void bvh_sweep(struct sweep_hit *h, struct vec2 p, struct vec2 d, float r) {
+	const struct bvh_node *n;
+	struct vec2 lo, hi;
+	int stack[MAX_DEPTH];
+	int sp, i;
+
+	lo.x = fminf(p.x, p.x + d.x) - r;
+	lo.y = fminf(p.y, p.y + d.y) - r;
+	hi.x = fmaxf(p.x, p.x + d.x) + r;
+	hi.y = fmaxf(p.y, p.y + d.y) + r;
+	sp = 0;
+	stack[sp++] = 0;
+	while (sp) {
+		n = &nodes[stack[--sp]];
+		if (n->min.x > hi.x || n->max.x < lo.x ||
+				n->min.y > hi.y || n->max.y < lo.y)
+			continue;
+		if (n->count) {
+			for (i = n->first; i < n->first + n->count; i++)
+				sweep_segment(h, p, d, r, &segs[i]);
+			continue;
+		}
+		stack[sp++] = n->first;
+		stack[sp++] = n - nodes + 1;
+	}
+}
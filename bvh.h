@@ -0,0 +1,13 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "sim.h"
+
+struct sweep_hit;
+
+void bvh_build(const struct table *t);
+void bvh_border(const struct ball *b, int i, float dt);
+float bvh_distance(struct vec2 p);
+void bvh_sweep(struct sweep_hit *h, struct vec2 p, struct vec2 d, float r);
+
+#endif
@@ -0,0 +1,266 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "contact.h"
+#include "draw.h"
+#include "pool.h"
+
+#define MAX_COLORS 64
+#define BATCH_CHUNK 64
+
+struct batch_job {
+	void (*fn)(struct contact *c);
+	int first;
+	int end;
+};
+
+int solver_iterations = 1;
+int warm_start;
+
+static struct contact *cur, *sorted;
+static int n_cur, cap;
+static uint64_t masks[N_BALLS];
+static int batch[MAX_COLORS + 1];
+static int n_colors;
+
+void contact_begin(void) {
+	n_cur = 0;
+}
+
+void contact_add(int a, int b, int feature, struct vec2 n, float depth,
+		float target) {
+	struct contact *c;
+
+	if (n_cur == cap) {
+		cap = cap ? cap * 2 : 64;
+		cur = realloc(cur, cap * sizeof(*cur));
+		sorted = realloc(sorted, cap * sizeof(*sorted));
+		if (!cur || !sorted)
+			die("realloc: out of memory\n");
+	}
+	c = &cur[n_cur++];
+	c->a = a;
+	c->b = b;
+	c->feature = feature;
+	c->n = n;
+	c->depth = depth;
+	c->target = target;
+	c->impulse = 0.0F;
+}
+
+int contact_count(void) {
+	return n_cur;
+}
+
+const struct contact *contact_list(void) {
+	return cur;
+}
+
+static float inv_mass(int i) {
+	return i < 0 ? 0.0F : 1.0F / world.balls[i].mass;
+}
+
+static void apply(const struct contact *c, float j) {
+	struct ball *a, *b;
+
+	a = &world.balls[c->a];
+	a->vel.x += c->n.x * j * inv_mass(c->a);
+	a->vel.y += c->n.y * j * inv_mass(c->a);
+	if (c->b < 0)
+		return;
+	b = &world.balls[c->b];
+	b->vel.x -= c->n.x * j * inv_mass(c->b);
+	b->vel.y -= c->n.y * j * inv_mass(c->b);
+}
+
+static float rel_vel(const struct contact *c) {
+	const struct ball *a, *b;
+	float v;
+
+	a = &world.balls[c->a];
+	v = a->vel.x * c->n.x + a->vel.y * c->n.y;
+	if (c->b < 0)
+		return v;
+	b = &world.balls[c->b];
+	return v - (b->vel.x * c->n.x + b->vel.y * c->n.y);
+}
+
+static int cmp_warm(const void *a, const void *b) {
+	const struct warm *p, *q;
+
+	p = a;
+	q = b;
+	if (p->a != q->a)
+		return p->a < q->a ? -1 : 1;
+	if (p->b != q->b)
+		return p->b < q->b ? -1 : 1;
+	if (p->feature != q->feature)
+		return p->feature < q->feature ? -1 : 1;
+	return 0;
+}
+
+static void warm(struct contact *c) {
+	const struct warm *p;
+	struct warm key;
+
+	key.a = c->a;
+	key.b = c->b;
+	key.feature = c->feature;
+	p = bsearch(&key, world.warm, world.n_warm, sizeof(*world.warm),
+			cmp_warm);
+	if (!p)
+		return;
+	c->impulse = p->impulse;
+	apply(c, c->impulse);
+}
+
+static void keep_warm(void) {
+	struct warm *w;
+	int i;
+
+	world.n_warm = n_cur < MAX_WARM ? n_cur : MAX_WARM;
+	for (i = 0; i < world.n_warm; i++) {
+		w = &world.warm[i];
+		w->a = cur[i].a;
+		w->b = cur[i].b;
+		w->feature = cur[i].feature;
+		w->impulse = cur[i].impulse;
+	}
+	qsort(world.warm, world.n_warm, sizeof(*world.warm), cmp_warm);
+}
+
+static void correct(struct contact *c) {
+	struct ball *a, *b;
+	float share;
+
+	a = &world.balls[c->a];
+	share = c->b < 0 ? c->depth : c->depth / 2.0F;
+	a->pos.x += c->n.x * share;
+	a->pos.y += c->n.y * share;
+	if (c->b < 0)
+		return;
+	b = &world.balls[c->b];
+	b->pos.x -= c->n.x * share;
+	b->pos.y -= c->n.y * share;
+}
+
+static void impulse(struct contact *c) {
+	float j, old;
+
+	j = (c->target - rel_vel(c)) / (inv_mass(c->a) + inv_mass(c->b));
+	old = c->impulse;
+	c->impulse = fmaxf(old + j, 0.0F);
+	apply(c, c->impulse - old);
+}
+
+static int pick_color(const struct contact *c) {
+	uint64_t used;
+	int k;
+
+	used = masks[c->a];
+	if (c->b >= 0)
+		used |= masks[c->b];
+	for (k = 0; k < MAX_COLORS - 1; k++) {
+		if (!(used >> k & 1))
+			break;
+	}
+	if (k < MAX_COLORS - 1) {
+		masks[c->a] |= (uint64_t) 1 << k;
+		if (c->b >= 0)
+			masks[c->b] |= (uint64_t) 1 << k;
+	}
+	return k;
+}
+
+static void color(void) {
+	struct contact *c, *t;
+	int count[MAX_COLORS];
+	int i, k;
+
+	memset(masks, 0, sizeof(masks));
+	memset(count, 0, sizeof(count));
+	n_colors = 0;
+	for (c = cur; c < cur + n_cur; c++) {
+		k = pick_color(c);
+		c->color = k;
+		count[k]++;
+		if (k >= n_colors)
+			n_colors = k + 1;
+	}
+	batch[0] = 0;
+	for (i = 0; i < MAX_COLORS; i++)
+		batch[i + 1] = batch[i] + count[i];
+	memcpy(count, batch, sizeof(count));
+	for (c = cur; c < cur + n_cur; c++)
+		sorted[count[c->color]++] = *c;
+	t = cur;
+	cur = sorted;
+	sorted = t;
+}
+
+static void run_chunk(void *arg, int k) {
+	const struct batch_job *j;
+	struct contact *c, *end;
+
+	j = arg;
+	c = cur + j->first + k * BATCH_CHUNK;
+	end = cur + j->first + (k + 1) * BATCH_CHUNK;
+	if (end > cur + j->end)
+		end = cur + j->end;
+	for (; c < end; c++)
+		j->fn(c);
+}
+
+static void each_batch(void (*fn)(struct contact *c)) {
+	struct batch_job j;
+	struct contact *c;
+	int i;
+
+	j.fn = fn;
+	for (i = 0; i < n_colors && i < MAX_COLORS - 1; i++) {
+		j.first = batch[i];
+		j.end = batch[i + 1];
+		pool_run(run_chunk, &j,
+				(j.end - j.first + BATCH_CHUNK - 1) / BATCH_CHUNK);
+	}
+	for (c = cur + batch[MAX_COLORS - 1]; c < cur + n_cur; c++)
+		fn(c);
+}
+
+void contact_solve(void) {
+	int it;
+
+	color();
+	each_batch(correct);
+	if (warm_start)
+		each_batch(warm);
+	for (it = 0; it < solver_iterations; it++)
+		each_batch(impulse);
+	if (warm_start)
+		keep_warm();
+}
+
+void contact_remap(const int *index) {
+	struct contact *c;
+	struct warm *w;
+	int t;
+
+	for (c = cur; c < cur + n_cur; c++) {
+		c->a = index[c->a];
+		if (c->b >= 0)
+			c->b = index[c->b];
+	}
+	for (w = world.warm; w < world.warm + world.n_warm; w++) {
+		w->a = index[w->a];
+		if (w->b < 0)
+			continue;
+		w->b = index[w->b];
+		if (w->a > w->b) {
+			t = w->a;
+			w->a = w->b;
+			w->b = t;
+		}
+	}
+	qsort(world.warm, world.n_warm, sizeof(*world.warm), cmp_warm);
+}
@@ -0,0 +1,34 @@
+#ifndef CONTACT_H
+#define CONTACT_H
+
+#include "sim.h"
+
+#define FEATURE_BALL 0
+#define FEATURE_OBSTACLE 1
+#define FEATURE_WALL 2
+#define FEATURE_FLIPPER 3
+#define FEATURE(kind, id) ((kind) << 24 | (id))
+
+struct contact {
+	int a;
+	int b;
+	int feature;
+	struct vec2 n;
+	float depth;
+	float target;
+	float impulse;
+	int color;
+};
+
+extern int solver_iterations;
+extern int warm_start;
+
+void contact_begin(void);
+void contact_add(int a, int b, int feature, struct vec2 n, float depth,
+		float target);
+int contact_count(void);
+const struct contact *contact_list(void);
+void contact_solve(void);
+void contact_remap(const int *index);
+
+#endif
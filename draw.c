@@ -1,10 +1,10 @@
 #include <glad/gl.h>
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <cglm/cglm.h>
+#include "draw.h"
 #include "sim.h"
 
 #define N_CIRCLE 256
@@ -23,18 +23,10 @@ static struct vec2 rect[N_RECT] = {
 	{1.0F, 0.0F}
 };
 
-#define BORDER_SIZE (N_BORDER * sizeof(struct vec2))
+#define BORDER_SIZE (table.n_border * sizeof(struct vec2))
 #define CIRCLE_SIZE (N_CIRCLE * sizeof(struct vec2))
 #define RECT_SIZE (N_RECT * sizeof(struct vec2))
 
-void die(const char *fmt, ...) {
-	va_list ap;	
-	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
-	va_end(ap);
-	exit(1);
-}
-
 static void bind_data(int i, int sz, const void *data) {
 	glBindVertexArray(vao[i]);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo[i]);
@@ -49,7 +41,7 @@ static void init_circle(void) {
 
 	glCreateVertexArrays(3, vao);
 	glCreateBuffers(3, vbo);
-	bind_data(0, BORDER_SIZE, border);
+	bind_data(0, BORDER_SIZE, table.border);
 	circle = malloc(CIRCLE_SIZE);
 	if (!circle)
 		die("malloc: out of memory\n");
@@ -131,12 +123,13 @@ static void vec3_xyz(float x, float y, float z, vec3 v) {
 	v[2] = z;
 }
 
-void draw(int negate) {
+void draw(void) {
 	int i;
 	mat4 m0, m1, m2;
 	vec3 v;
 	struct ball *b;
-	struct obstacle *o;
+	const struct polyline *l;
+	const struct obstacle *o;
 	struct flipper *f;
 
 	glClearColor(0.0F, 0.0F, 0.0F, 1.0F);
@@ -148,10 +141,14 @@ void draw(int negate) {
 	vec3_xyz(2.0F, 2.0F / 1.7F, 1.0F, v);
 	glm_scale(m0, v);
 	glUniformMatrix4fv(model_loc, 1, GL_FALSE, (float *) m0);
-	glDrawArrays(GL_LINE_LOOP, 0, N_BORDER);
+	for (i = 0; i < table.n_lines; i++) {
+		l = &table.lines[i];
+		glDrawArrays(l->closed ? GL_LINE_LOOP : GL_LINE_STRIP,
+				l->first, l->n);
+	}
 	glBindVertexArray(vao[1]);
 	for (i = 0; i < N_BALLS; i++) {
-		b = &balls[i];
+		b = &world.balls[i];
 		glm_mat4_copy(m0, m1);
 		vec3_xyz(b->pos.x, b->pos.y, 0.0F, v);
 		glm_translate(m1, v);
@@ -160,8 +157,8 @@ void draw(int negate) {
 		glUniformMatrix4fv(model_loc, 1, GL_FALSE, (float *) m1);
 		glDrawArrays(GL_TRIANGLE_FAN, 0, N_CIRCLE);
 	}
-	for (i = 0; i < N_OBSTACLES; i++) {
-		o = &obstacles[i];
+	for (i = 0; i < table.n_obstacles; i++) {
+		o = &table.obstacles[i];
 		glm_mat4_copy(m0, m1);
 		vec3_xyz(o->pos.x, o->pos.y, 0.0F, v);
 		glm_translate(m1, v);
@@ -172,7 +169,7 @@ void draw(int negate) {
 	}
 	for (i = 0; i < N_FLIPPERS; i++) {
 		glBindVertexArray(vao[1]);
-		f = &flippers[i];
+		f = &world.flippers[i];
 		glm_mat4_copy(m0, m1);
 		vec3_xyz(f->pos.x, f->pos.y, 0.0F, v);
 		glm_translate(m1, v);
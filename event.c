@@ -0,0 +1,245 @@
+#include <math.h>
+#include "bvh.h"
+#include "event.h"
+#include "kern.h"
+
+#define EVENT_MARGIN 1e-3F
+#define MAX_HORIZON (1L << 30)
+#define CONTACT_TICKS 8
+
+struct plan {
+	long tick;
+	struct vec2 anchor;
+	float reach;
+	int contact;
+};
+
+static struct plan plans[N_BALLS];
+static int heap[N_BALLS];
+static int n_heap;
+static long now;
+static int n_contact;
+
+static int flippers_moving(void) {
+	const struct flipper *f;
+	int i;
+
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		if (f->touch_id < 0 ? f->rot > 0.0F : f->rot < f->max_rot)
+			return 1;
+	}
+	return 0;
+}
+
+static float static_clearance(const struct ball *b) {
+	const struct obstacle *o;
+	const struct flipper *f;
+	struct vec2 d, tip, ab;
+	float dist, rot, t;
+	int i;
+
+	dist = bvh_distance(b->pos);
+	for (i = 0; i < table.n_obstacles; i++) {
+		o = &table.obstacles[i];
+		d = vec2_sub(b->pos, o->pos);
+		dist = fminf(dist, sqrtf(dot(d, d)) - o->radius);
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		rot = -(f->rest_rad + f->sign * f->rot);
+		tip.x = f->pos.x + cosf(rot) * f->length;
+		tip.y = f->pos.y + sinf(rot) * f->length;
+		ab = vec2_sub(tip, f->pos);
+		d = vec2_sub(b->pos, f->pos);
+		t = clamp(dot(d, ab) / dot(ab, ab), 0.0F, 1.0F);
+		d.x -= ab.x * t;
+		d.y -= ab.y * t;
+		dist = fminf(dist, sqrtf(dot(d, d)) - f->radius);
+	}
+	return dist - b->radius;
+}
+
+static long horizon(const struct ball *b, float reach) {
+	float a, v, n;
+
+	a = 0.5F * sqrtf(dot(gravity, gravity)) * DT * DT;
+	v = sqrtf(dot(b->vel, b->vel)) * DT + a;
+	if (reach <= 0.0F)
+		return 0;
+	if (a == 0.0F)
+		n = v == 0.0F ? MAX_HORIZON : reach / v;
+	else
+		n = (sqrtf(v * v + 4.0F * a * reach) - v) / (2.0F * a);
+	return n < MAX_HORIZON ? (long) n : MAX_HORIZON;
+}
+
+static void plan(int i) {
+	const struct ball *b, *o;
+	struct plan *p;
+	struct vec2 d;
+	float reach;
+	int j;
+
+	b = &world.balls[i];
+	p = &plans[i];
+	if (b->sleep) {
+		p->anchor = b->pos;
+		p->reach = 0.0F;
+		p->tick = now + MAX_HORIZON;
+		p->contact = 0;
+		return;
+	}
+	reach = static_clearance(b);
+	for (j = 0; j < N_BALLS; j++) {
+		if (j == i)
+			continue;
+		o = &world.balls[j];
+		d = vec2_sub(b->pos, plans[j].anchor);
+		reach = fminf(reach, 0.5F * (sqrtf(dot(d, d)) -
+				plans[j].reach - b->radius - o->radius));
+	}
+	p->anchor = b->pos;
+	p->reach = fmaxf(reach - EVENT_MARGIN, 0.0F);
+	p->tick = now + horizon(b, p->reach);
+	p->contact = p->tick == now;
+	if (p->contact) {
+		p->tick += CONTACT_TICKS;
+		n_contact++;
+	}
+}
+
+static void swap(int a, int b) {
+	int t;
+
+	t = heap[a];
+	heap[a] = heap[b];
+	heap[b] = t;
+}
+
+static void push(int i) {
+	int c;
+
+	c = n_heap++;
+	heap[c] = i;
+	while (c && plans[heap[c]].tick < plans[heap[(c - 1) / 2]].tick) {
+		swap(c, (c - 1) / 2);
+		c = (c - 1) / 2;
+	}
+}
+
+static int pop(void) {
+	int i, c, l;
+
+	i = heap[0];
+	heap[0] = heap[--n_heap];
+	c = 0;
+	while ((l = 2 * c + 1) < n_heap) {
+		if (l + 1 < n_heap && plans[heap[l + 1]].tick < plans[heap[l]].tick)
+			l++;
+		if (plans[heap[c]].tick <= plans[heap[l]].tick)
+			break;
+		swap(c, l);
+		c = l;
+	}
+	return i;
+}
+
+static void plan_all(void) {
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		plans[i].anchor = world.balls[i].pos;
+		plans[i].reach = 0.0F;
+	}
+	n_heap = 0;
+	n_contact = 0;
+	for (i = 0; i < N_BALLS; i++) {
+		plan(i);
+		push(i);
+	}
+}
+
+static void fly(long k) {
+	struct ball *b;
+	float t;
+	int i;
+
+	t = k * DT;
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		if (b->sleep)
+			continue;
+		b->pos.x += (b->vel.x + 0.5F * gravity.x * t) * t;
+		b->pos.y += (b->vel.y + 0.5F * gravity.y * t) * t;
+		b->vel.x += gravity.x * t;
+		b->vel.y += gravity.y * t;
+	}
+	for (i = 0; i < N_FLIPPERS; i++)
+		world.flippers[i].cur_wvel = 0.0F;
+}
+
+static int step_invalidates(void) {
+	int asleep[N_BALLS];
+	int i, changed;
+	uint32_t sorts;
+
+	for (i = 0; i < N_BALLS; i++)
+		asleep[i] = world.balls[i].sleep;
+	sorts = world.sorts;
+	simulate();
+	if (world.sorts != sorts)
+		return 1;
+	changed = 0;
+	for (i = 0; i < N_BALLS; i++)
+		changed |= asleep[i] != world.balls[i].sleep;
+	return changed;
+}
+
+void simulate_ticks(long n) {
+	int due[N_BALLS];
+	int i, n_due, stale;
+	long k;
+
+	if (fixed_mode) {
+		while (n-- > 0)
+			simulate();
+		return;
+	}
+	stale = 1;
+	while (n > 0) {
+		if (flippers_moving()) {
+			simulate();
+			now++;
+			n--;
+			stale = 1;
+			continue;
+		}
+		if (stale) {
+			plan_all();
+			stale = 0;
+		}
+		k = n_contact ? 0 : plans[heap[0]].tick - now;
+		if (k > n)
+			k = n;
+		if (k > 0) {
+			fly(k);
+			now += k;
+			n -= k;
+			continue;
+		}
+		stale = step_invalidates();
+		now++;
+		n--;
+		if (stale)
+			continue;
+		n_due = 0;
+		while (n_heap && plans[heap[0]].tick < now)
+			due[n_due++] = pop();
+		for (i = 0; i < n_due; i++) {
+			n_contact -= plans[due[i]].contact;
+			plan(due[i]);
+			push(due[i]);
+		}
+	}
+}
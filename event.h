@@ -0,0 +1,6 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+void simulate_ticks(long n);
+
+#endif
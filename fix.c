@@ -0,0 +1,778 @@
+#include <math.h>
+#include <stdlib.h>
+#include "draw.h"
+#include "fix.h"
+#include "kern.h"
+
+#define SIN_STEPS 1024
+#define FIX_2PI 411775
+#define FIX_NONE INT32_MAX
+#define MAX_SWEEPS 4
+#define MAX_ADVANCE 32
+#define CONTACT_EPS 66
+#define WIDE_LIMIT ((fix2) 1 << 47)
+
+typedef unsigned __int128 fix4;
+
+struct fball {
+	fix radius;
+	fix mass;
+	fix rest;
+	struct fvec pos;
+	struct fvec vel;
+};
+
+struct fflipper {
+	fix radius;
+	struct fvec pos;
+	fix length;
+	fix rest_rad;
+	fix max_rot;
+	fix sign;
+	fix wvel;
+	fix rot;
+	fix cur_wvel;
+	int touch;
+};
+
+struct fgeom {
+	struct fvec pos;
+	struct fvec ab;
+	fix2 a_ab;
+	fix2 ab2;
+	fix radius;
+	fix wvel;
+	fix bound;
+};
+
+struct fseg {
+	struct fvec a;
+	struct fvec ab;
+	struct fvec n;
+	struct fvec lo;
+	struct fvec hi;
+	fix2 a_ab;
+	fix2 ab2;
+	int sided;
+};
+
+struct fobstacle {
+	struct fvec pos;
+	fix radius;
+	fix push_vel;
+};
+
+struct fhit {
+	fix t;
+	struct fvec n;
+	fix push_vel;
+	int wall;
+};
+
+struct fcontact {
+	int a;
+	int b;
+	struct fvec n;
+	fix depth;
+	fix target;
+	fix wa;
+	fix wb;
+	fix impulse;
+};
+
+static fix sin_table[SIN_STEPS + 1];
+static struct fseg *segs;
+static int n_segs;
+static struct fobstacle *obstacles;
+static int n_obstacles;
+static struct fball balls[N_BALLS];
+static struct fflipper flippers[N_FLIPPERS];
+static struct fgeom geom[N_FLIPPERS];
+static struct fcontact *contacts;
+static int n_contacts;
+static int cap;
+
+static fix to_fix(float v) {
+	return lrintf(v * FIX_ONE);
+}
+
+static float to_float(fix v) {
+	return v / (float) FIX_ONE;
+}
+
+static fix narrow(fix2 v) {
+	return v >> FIX_SHIFT;
+}
+
+static fix saturate(fix2 v) {
+	return v > INT32_MAX ? INT32_MAX : v < -INT32_MAX ? -INT32_MAX : v;
+}
+
+static fix fmul(fix a, fix b) {
+	return (fix2) a * b >> FIX_SHIFT;
+}
+
+static fix fdiv(fix a, fix b) {
+	if (b == 0)
+		die("fdiv: division by zero\n");
+	return saturate(((fix2) a << FIX_SHIFT) / b);
+}
+
+static fix ratio(fix2 num, fix2 den) {
+	__int128 q;
+
+	if (den == 0)
+		die("ratio: division by zero\n");
+	if (num < WIDE_LIMIT && num > -WIDE_LIMIT)
+		return saturate((num << FIX_SHIFT) / den);
+	q = ((__int128) num << FIX_SHIFT) / den;
+	return q > INT32_MAX ? INT32_MAX : q < -INT32_MAX ? -INT32_MAX : q;
+}
+
+static fix fabsx(fix v) {
+	return v < 0 ? -v : v;
+}
+
+static fix fminx(fix a, fix b) {
+	return a < b ? a : b;
+}
+
+static fix fmaxx(fix a, fix b) {
+	return a > b ? a : b;
+}
+
+static fix clampx(fix v, fix l, fix h) {
+	return fmaxx(fminx(v, h), l);
+}
+
+static fix2 fdot(struct fvec a, struct fvec b) {
+	return (fix2) a.x * b.x + (fix2) a.y * b.y;
+}
+
+static struct fvec fsub(struct fvec a, struct fvec b) {
+	struct fvec r;
+
+	r.x = a.x - b.x;
+	r.y = a.y - b.y;
+	return r;
+}
+
+static struct fvec fscale(struct fvec a, fix s) {
+	struct fvec r;
+
+	r.x = fmul(a.x, s);
+	r.y = fmul(a.y, s);
+	return r;
+}
+
+static struct fvec fvec_of(struct vec2 v) {
+	struct fvec r;
+
+	r.x = to_fix(v.x);
+	r.y = to_fix(v.y);
+	return r;
+}
+
+static uint64_t isqrt(fix4 v) {
+	fix4 r;
+
+	if (v >> 64) {
+		r = (uint64_t) sqrt((double) (v >> 2)) * 2;
+		r = (r + v / r) / 2;
+	} else {
+		r = (uint64_t) sqrt((double) (uint64_t) v);
+	}
+	while (r * r > v)
+		r--;
+	while ((r + 1) * (r + 1) <= v)
+		r++;
+	return r;
+}
+
+static fix fsqrt(fix2 v) {
+	return v > 0 ? isqrt(v) : 0;
+}
+
+static fix2 fsqrt4(__int128 v) {
+	return v > 0 ? isqrt(v) : 0;
+}
+
+static int64_t poly_sin(int64_t x) {
+	int64_t x2, r;
+	int k;
+
+	x2 = x * x >> 30;
+	r = 1LL << 30;
+	for (k = 11; k > 1; k -= 2)
+		r = (1LL << 30) - (x2 * r >> 30) / (k * (k - 1));
+	return x * r >> 30;
+}
+
+static fix fsin(fix a) {
+	int64_t p;
+	int i, q, frac;
+	fix s0, s1;
+
+	p = (int64_t) a * (4 * SIN_STEPS) * FIX_ONE / FIX_2PI;
+	p %= (int64_t) 4 * SIN_STEPS * FIX_ONE;
+	if (p < 0)
+		p += (int64_t) 4 * SIN_STEPS * FIX_ONE;
+	i = p >> FIX_SHIFT;
+	frac = p & (FIX_ONE - 1);
+	q = i / SIN_STEPS;
+	i %= SIN_STEPS;
+	if (q & 1) {
+		s0 = sin_table[SIN_STEPS - i];
+		s1 = sin_table[SIN_STEPS - i - 1];
+	} else {
+		s0 = sin_table[i];
+		s1 = sin_table[i + 1];
+	}
+	s0 += fmul(s1 - s0, frac);
+	return q & 2 ? -s0 : s0;
+}
+
+static fix fcos(fix a) {
+	return fsin(a + FIX_2PI / 4);
+}
+
+void fix_init(void) {
+	const struct polyline *l;
+	const struct obstacle *o;
+	struct fseg *s;
+	fix len;
+	int i, j;
+
+	for (i = 0; i <= SIN_STEPS; i++)
+		sin_table[i] = poly_sin(((int64_t) 1686629713 * i /
+					SIN_STEPS)) >> 14;
+	n_segs = 0;
+	for (l = table.lines; l < table.lines + table.n_lines; l++)
+		n_segs += line_segments(l);
+	free(segs);
+	free(obstacles);
+	segs = malloc(n_segs * sizeof(*segs));
+	obstacles = malloc(table.n_obstacles * sizeof(*obstacles));
+	if (!segs || (table.n_obstacles && !obstacles))
+		die("malloc: out of memory\n");
+	s = segs;
+	for (l = table.lines; l < table.lines + table.n_lines; l++) {
+		for (i = 0; i < line_segments(l); i++) {
+			j = l->first + (i + 1) % l->n;
+			s->a = fvec_of(table.border[l->first + i]);
+			s->ab = fsub(fvec_of(table.border[j]), s->a);
+			s->a_ab = fdot(s->a, s->ab);
+			s->ab2 = fdot(s->ab, s->ab);
+			len = fsqrt(s->ab2);
+			if (len == 0)
+				die("fix_init: segment %d below fixed-point "
+						"resolution\n", (int) (s - segs));
+			s->n.x = fdiv(-s->ab.y, len);
+			s->n.y = fdiv(s->ab.x, len);
+			s->lo.x = fminx(s->a.x, s->a.x + s->ab.x);
+			s->lo.y = fminx(s->a.y, s->a.y + s->ab.y);
+			s->hi.x = fmaxx(s->a.x, s->a.x + s->ab.x);
+			s->hi.y = fmaxx(s->a.y, s->a.y + s->ab.y);
+			s->sided = l->closed;
+			s++;
+		}
+	}
+	n_obstacles = table.n_obstacles;
+	for (i = 0; i < n_obstacles; i++) {
+		o = &table.obstacles[i];
+		obstacles[i].pos = fvec_of(o->pos);
+		obstacles[i].radius = to_fix(o->radius);
+		obstacles[i].push_vel = to_fix(o->push_vel);
+	}
+}
+
+static void import(void) {
+	const struct ball *b;
+	const struct flipper *f;
+	struct fball *fb;
+	struct fflipper *ff;
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		fb = &balls[i];
+		fb->radius = to_fix(b->radius);
+		fb->mass = to_fix(b->mass);
+		fb->rest = to_fix(b->restitution);
+		fb->pos = fvec_of(b->pos);
+		fb->vel = fvec_of(b->vel);
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		ff = &flippers[i];
+		ff->radius = to_fix(f->radius);
+		ff->pos = fvec_of(f->pos);
+		ff->length = to_fix(f->length);
+		ff->rest_rad = to_fix(f->rest_rad);
+		ff->max_rot = to_fix(f->max_rot);
+		ff->sign = to_fix(f->sign);
+		ff->wvel = to_fix(f->wvel);
+		ff->rot = to_fix(f->rot);
+		ff->cur_wvel = to_fix(f->cur_wvel);
+		ff->touch = f->touch_id >= 0.0F;
+	}
+}
+
+static void export(void) {
+	struct ball *b;
+	struct flipper *f;
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		b->pos.x = to_float(balls[i].pos.x);
+		b->pos.y = to_float(balls[i].pos.y);
+		b->vel.x = to_float(balls[i].vel.x);
+		b->vel.y = to_float(balls[i].vel.y);
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		f->rot = to_float(flippers[i].rot);
+		f->cur_wvel = to_float(flippers[i].cur_wvel);
+	}
+}
+
+static fix fsweep_circle(struct fvec p, struct fvec d, struct fvec c,
+		fix r) {
+	struct fvec m;
+	fix2 a, b, k;
+	__int128 disc;
+
+	m = fsub(p, c);
+	k = fdot(m, m) - (fix2) r * r;
+	b = fdot(m, d);
+	if (k <= 0 || b >= 0)
+		return FIX_NONE;
+	a = fdot(d, d);
+	disc = (__int128) b * b - (__int128) a * k;
+	if (disc < 0)
+		return FIX_NONE;
+	return ratio(-b - fsqrt4(disc), a);
+}
+
+static void fsweep_point(struct fhit *h, struct fvec p, struct fvec d,
+		struct fvec c, fix r, int wall, fix push_vel) {
+	struct fvec n;
+	fix t, len;
+
+	t = fsweep_circle(p, d, c, r);
+	if (t >= h->t)
+		return;
+	n = fsub(p, c);
+	n.x += fmul(d.x, t);
+	n.y += fmul(d.y, t);
+	len = fsqrt(fdot(n, n));
+	if (len == 0)
+		return;
+	h->t = t;
+	h->n.x = fdiv(n.x, len);
+	h->n.y = fdiv(n.y, len);
+	h->push_vel = push_vel;
+	h->wall = wall;
+}
+
+static void fsweep_segment(struct fhit *h, struct fvec p, struct fvec d,
+		fix r, const struct fseg *s) {
+	struct fvec n, q;
+	fix dist, dn, t, u;
+
+	n = s->n;
+	dist = narrow(fdot(fsub(p, s->a), n));
+	if (dist < 0) {
+		if (s->sided)
+			return;
+		n.x = -n.x;
+		n.y = -n.y;
+		dist = -dist;
+	}
+	dn = narrow(fdot(d, n));
+	if (dist > r && dn < 0) {
+		t = fdiv(dist - r, -dn);
+		q.x = p.x + fmul(d.x, t);
+		q.y = p.y + fmul(d.y, t);
+		u = ratio(fdot(q, s->ab) - s->a_ab, s->ab2);
+		if (t < h->t && u >= 0 && u <= FIX_ONE) {
+			h->t = t;
+			h->n = n;
+			h->wall = 1;
+		}
+	}
+	q.x = s->a.x + s->ab.x;
+	q.y = s->a.y + s->ab.y;
+	fsweep_point(h, p, d, s->a, r, 1, 0);
+	fsweep_point(h, p, d, q, r, 1, 0);
+}
+
+static void advance(struct fball *b, fix dt) {
+	const struct fobstacle *o;
+	const struct fseg *s;
+	struct fhit h;
+	struct fvec d;
+	fix left, v0, v1;
+	int i;
+
+	d = fscale(b->vel, dt);
+	if (fdot(d, d) <= (fix2) b->radius * b->radius) {
+		b->pos.x += d.x;
+		b->pos.y += d.y;
+		return;
+	}
+	left = FIX_ONE;
+	for (i = 0; i < MAX_SWEEPS; i++) {
+		d = fscale(fscale(b->vel, dt), left);
+		h.t = FIX_ONE;
+		h.wall = -1;
+		for (s = segs; s < segs + n_segs; s++)
+			fsweep_segment(&h, b->pos, d, b->radius, s);
+		for (o = obstacles; o < obstacles + n_obstacles; o++)
+			fsweep_point(&h, b->pos, d, o->pos,
+					b->radius + o->radius, 0, o->push_vel);
+		b->pos.x += fmul(d.x, h.t);
+		b->pos.y += fmul(d.y, h.t);
+		if (h.wall < 0)
+			return;
+		v0 = narrow(fdot(b->vel, h.n));
+		v1 = h.wall ? fmul(fabsx(v0), b->rest) : h.push_vel;
+		b->vel.x += fmul(h.n.x, v1 - v0);
+		b->vel.y += fmul(h.n.y, v1 - v0);
+		left = fmul(left, FIX_ONE - h.t);
+	}
+}
+
+static struct fvec closest_pos(struct fvec p, struct fvec a, struct fvec b) {
+	struct fvec ab;
+	fix2 ab2;
+	fix t;
+
+	ab = fsub(b, a);
+	ab2 = fdot(ab, ab);
+	t = ab2 ? clampx(ratio(fdot(p, ab) - fdot(a, ab), ab2), 0, FIX_ONE) : 0;
+	a.x += fmul(ab.x, t);
+	a.y += fmul(ab.y, t);
+	return a;
+}
+
+static struct fvec tip_at(const struct fflipper *f, fix rot) {
+	struct fvec tip;
+
+	tip.x = f->pos.x + fmul(fcos(rot), f->length);
+	tip.y = f->pos.y + fmul(fsin(rot), f->length);
+	return tip;
+}
+
+static void update_geom(struct fgeom *g, const struct fflipper *f) {
+	g->pos = f->pos;
+	g->ab = fsub(tip_at(f, -(f->rest_rad + fmul(f->sign, f->rot))), f->pos);
+	g->a_ab = fdot(g->pos, g->ab);
+	g->ab2 = fdot(g->ab, g->ab);
+	g->radius = f->radius;
+	g->wvel = f->cur_wvel;
+	g->bound = f->length + f->radius;
+}
+
+static fix surface_vel(const struct fgeom *g, struct fvec pos,
+		struct fvec dir) {
+	pos.x = fmul(pos.x + fmul(dir.x, g->radius) - g->pos.x, g->wvel);
+	pos.y = fmul(pos.y + fmul(dir.y, g->radius) - g->pos.y, g->wvel);
+	return fmul(-pos.y, dir.x) + fmul(pos.x, dir.y);
+}
+
+static void sweep_flipper(struct fball *a, const struct fflipper *f,
+		const struct fgeom *g, struct fvec start, fix dt) {
+	struct fvec d, p, c, dir;
+	fix rot, drot, bound, dist, s, t;
+	int i;
+
+	d = fsub(a->pos, start);
+	drot = fmul(g->wvel, dt);
+	bound = fsqrt(fdot(d, d)) + fmul(fabsx(drot), f->length);
+	if (bound <= a->radius)
+		return;
+	c = fsub(closest_pos(g->pos, start, a->pos), g->pos);
+	s = g->bound + a->radius;
+	if (fdot(c, c) > (fix2) s * s)
+		return;
+	rot = -(f->rest_rad + fmul(f->sign, f->rot));
+	t = 0;
+	for (i = 0; i < MAX_ADVANCE; i++) {
+		p.x = start.x + fmul(d.x, t);
+		p.y = start.y + fmul(d.y, t);
+		c = closest_pos(p, f->pos,
+				tip_at(f, rot - fmul(FIX_ONE - t, drot)));
+		dir = fsub(p, c);
+		dist = fsqrt(fdot(dir, dir)) - a->radius - f->radius;
+		if (dist <= CONTACT_EPS)
+			break;
+		t += fdiv(dist, bound);
+		if (t >= FIX_ONE)
+			return;
+	}
+	if (i == MAX_ADVANCE)
+		return;
+	dist += a->radius + f->radius;
+	if (dist == 0)
+		return;
+	dir.x = fdiv(dir.x, dist);
+	dir.y = fdiv(dir.y, dist);
+	s = surface_vel(g, c, dir) - narrow(fdot(a->vel, dir));
+	if (s <= 0)
+		return;
+	a->vel.x += fmul(dir.x, s);
+	a->vel.y += fmul(dir.y, s);
+	a->pos.x = p.x + fmul(fmul(a->vel.x, FIX_ONE - t), dt);
+	a->pos.y = p.y + fmul(fmul(a->vel.y, FIX_ONE - t), dt);
+}
+
+static void add(int a, int b, struct fvec n, fix depth, fix target) {
+	struct fcontact *c;
+	fix m;
+
+	if (n_contacts == cap) {
+		cap = cap ? cap * 2 : 64;
+		contacts = realloc(contacts, cap * sizeof(*contacts));
+		if (!contacts)
+			die("realloc: out of memory\n");
+	}
+	c = &contacts[n_contacts++];
+	c->a = a;
+	c->b = b;
+	c->n = n;
+	c->depth = depth;
+	c->target = target;
+	c->impulse = 0;
+	if (b < 0) {
+		c->wa = FIX_ONE;
+		c->wb = 0;
+		return;
+	}
+	m = balls[a].mass + balls[b].mass;
+	c->wa = fdiv(balls[b].mass, m);
+	c->wb = fdiv(balls[a].mass, m);
+}
+
+static void ball_ball(int i, int j) {
+	const struct fball *a, *b;
+	struct fvec n;
+	fix d, r;
+
+	a = &balls[i];
+	b = &balls[j];
+	n = fsub(a->pos, b->pos);
+	d = fsqrt(fdot(n, n));
+	if (d == 0 || d > a->radius + b->radius)
+		return;
+	n.x = fdiv(n.x, d);
+	n.y = fdiv(n.y, d);
+	r = fminx(a->rest, b->rest);
+	add(i, j, n, a->radius + b->radius - d,
+			-fmul(r, narrow(fdot(fsub(a->vel, b->vel), n))));
+}
+
+static void ball_obstacles(int i) {
+	const struct fobstacle *o;
+	const struct fball *a;
+	struct fvec v;
+	fix s;
+
+	a = &balls[i];
+	for (o = obstacles; o < obstacles + n_obstacles; o++) {
+		v = fsub(a->pos, o->pos);
+		s = fsqrt(fdot(v, v));
+		if (s == 0 || s > a->radius + o->radius)
+			continue;
+		v.x = fdiv(v.x, s);
+		v.y = fdiv(v.y, s);
+		add(i, -1, v, a->radius + o->radius - s, o->push_vel);
+	}
+}
+
+static void ball_flipper(int i, const struct fgeom *g) {
+	const struct fball *a;
+	struct fvec pos, dir;
+	fix s;
+
+	a = &balls[i];
+	dir = fsub(a->pos, g->pos);
+	s = g->bound + a->radius;
+	if (fdot(dir, dir) > (fix2) s * s)
+		return;
+	s = clampx(ratio(fdot(a->pos, g->ab) - g->a_ab, g->ab2), 0, FIX_ONE);
+	pos.x = g->pos.x + fmul(g->ab.x, s);
+	pos.y = g->pos.y + fmul(g->ab.y, s);
+	dir = fsub(a->pos, pos);
+	s = fsqrt(fdot(dir, dir));
+	if (s == 0 || s > a->radius + g->radius)
+		return;
+	dir.x = fdiv(dir.x, s);
+	dir.y = fdiv(dir.y, s);
+	add(i, -1, dir, a->radius + g->radius - s, surface_vel(g, pos, dir));
+}
+
+static void ball_border(int i, fix dt) {
+	const struct fball *b;
+	const struct fseg *s, *hit;
+	struct fvec p, d, disp;
+	fix2 min, dist2;
+	fix reach, t, dist, depth;
+
+	b = &balls[i];
+	reach = b->radius + fmul(fsqrt(fdot(b->vel, b->vel)), dt);
+	min = (fix2) reach * reach;
+	hit = NULL;
+	for (s = segs; s < segs + n_segs; s++) {
+		p.x = fmaxx(fmaxx(s->lo.x - b->pos.x, b->pos.x - s->hi.x), 0);
+		p.y = fmaxx(fmaxx(s->lo.y - b->pos.y, b->pos.y - s->hi.y), 0);
+		if (fdot(p, p) > min)
+			continue;
+		t = clampx(ratio(fdot(b->pos, s->ab) - s->a_ab, s->ab2),
+				0, FIX_ONE);
+		p.x = b->pos.x - (s->a.x + fmul(s->ab.x, t));
+		p.y = b->pos.y - (s->a.y + fmul(s->ab.y, t));
+		dist2 = fdot(p, p);
+		if (dist2 < min) {
+			min = dist2;
+			hit = s;
+			disp = p;
+		}
+	}
+	if (!hit)
+		return;
+	d = min == 0 ? hit->n : disp;
+	dist = fsqrt(fdot(d, d));
+	d.x = fdiv(d.x, dist);
+	d.y = fdiv(d.y, dist);
+	if (hit->sided && fdot(d, hit->n) < 0) {
+		d.x = -d.x;
+		d.y = -d.y;
+		depth = b->radius + dist;
+	} else if (dist > b->radius) {
+		return;
+	} else {
+		depth = b->radius - dist;
+	}
+	add(i, -1, d, depth, fmul(fabsx(narrow(fdot(b->vel, d))), b->rest));
+}
+
+static fix rel_vel(const struct fcontact *c) {
+	struct fvec v;
+
+	v = balls[c->a].vel;
+	if (c->b >= 0)
+		v = fsub(v, balls[c->b].vel);
+	return narrow(fdot(v, c->n));
+}
+
+static void solve(void) {
+	struct fcontact *c;
+	struct fball *a, *b;
+	fix share, j, old;
+	int it;
+
+	for (c = contacts; c < contacts + n_contacts; c++) {
+		a = &balls[c->a];
+		share = c->b < 0 ? c->depth : c->depth / 2;
+		a->pos.x += fmul(c->n.x, share);
+		a->pos.y += fmul(c->n.y, share);
+		if (c->b < 0)
+			continue;
+		b = &balls[c->b];
+		b->pos.x -= fmul(c->n.x, share);
+		b->pos.y -= fmul(c->n.y, share);
+	}
+	for (it = 0; it < solver_iterations; it++) {
+		for (c = contacts; c < contacts + n_contacts; c++) {
+			old = c->impulse;
+			c->impulse = fmaxx(old + c->target - rel_vel(c), 0);
+			j = c->impulse - old;
+			a = &balls[c->a];
+			a->vel.x += fmul(c->n.x, fmul(j, c->wa));
+			a->vel.y += fmul(c->n.y, fmul(j, c->wa));
+			if (c->b < 0)
+				continue;
+			b = &balls[c->b];
+			b->vel.x -= fmul(c->n.x, fmul(j, c->wb));
+			b->vel.y -= fmul(c->n.y, fmul(j, c->wb));
+		}
+	}
+}
+
+static void step(fix dt, struct fvec g) {
+	struct fflipper *f;
+	struct fball *b;
+	struct fvec start;
+	fix prev;
+	int i, j;
+
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &flippers[i];
+		prev = f->rot;
+		f->rot = f->touch ?
+			fminx(f->rot + fmul(dt, f->wvel), f->max_rot) :
+			fmaxx(f->rot - fmul(dt, f->wvel), 0);
+		f->cur_wvel = fdiv(fmul(f->sign, prev - f->rot), dt);
+		update_geom(&geom[i], f);
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		b = &balls[i];
+		b->vel.x += fmul(g.x, dt);
+		b->vel.y += fmul(g.y, dt);
+		start = b->pos;
+		advance(b, dt);
+		for (j = 0; j < N_FLIPPERS; j++)
+			sweep_flipper(b, &flippers[j], &geom[j], start, dt);
+	}
+	n_contacts = 0;
+	for (i = 0; i < N_BALLS; i++) {
+		for (j = i + 1; j < N_BALLS; j++)
+			ball_ball(i, j);
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		ball_obstacles(i);
+		for (j = 0; j < N_FLIPPERS; j++)
+			ball_flipper(i, &geom[j]);
+		ball_border(i, dt);
+	}
+	solve();
+}
+
+static int substeps(fix dt) {
+	const struct fflipper *f;
+	fix travel, min_r, q;
+	int i, n;
+
+	travel = 0;
+	min_r = INT32_MAX;
+	for (i = 0; i < N_BALLS; i++) {
+		travel = fmaxx(travel,
+				fmul(fsqrt(fdot(balls[i].vel, balls[i].vel)), dt));
+		min_r = fminx(min_r, balls[i].radius);
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &flippers[i];
+		if (f->touch ? f->rot < f->max_rot : f->rot > 0)
+			travel = fmaxx(travel,
+					fmul(fmul(f->wvel, dt), f->length));
+	}
+	q = fmaxx(min_r / 2, 1);
+	n = (travel + q - 1) / q;
+	return n < 1 ? 1 : n > max_substeps ? max_substeps : n;
+}
+
+void fix_simulate(void) {
+	struct fvec g;
+	fix dt;
+	int i, n;
+
+	import();
+	g = fvec_of(gravity);
+	dt = to_fix(DT);
+	n = substeps(dt);
+	for (i = 0; i < n; i++)
+		step(dt / n, g);
+	export();
+}
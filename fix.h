@@ -0,0 +1,20 @@
+#ifndef FIX_H
+#define FIX_H
+
+#include <stdint.h>
+
+#define FIX_SHIFT 16
+#define FIX_ONE (1 << FIX_SHIFT)
+
+typedef int32_t fix;
+typedef int64_t fix2;
+
+struct fvec {
+	fix x;
+	fix y;
+};
+
+void fix_init(void);
+void fix_simulate(void);
+
+#endif
@@ -0,0 +1,178 @@
+#include <math.h>
+#include <stdlib.h>
+#include "draw.h"
+#include "hist.h"
+
+#define POS_SCALE 4096.0F
+#define VEL_SCALE 1024.0F
+#define ROT_SCALE 4096.0F
+
+struct delta {
+	int16_t pos[N_BALLS][2];
+	int16_t vel[N_BALLS][2];
+	int16_t rot[N_FLIPPERS];
+	uint32_t touch;
+};
+
+struct quant {
+	int32_t pos[N_BALLS][2];
+	int32_t vel[N_BALLS][2];
+	int32_t rot[N_FLIPPERS];
+};
+
+static struct world *keys;
+static struct delta *deltas;
+static struct quant enc;
+static uint64_t first, last;
+
+static int16_t quant_step(int32_t *q, float v, float scale) {
+	int32_t d;
+
+	d = lrintf(v * scale) - *q;
+	if (d > INT16_MAX)
+		d = INT16_MAX;
+	else if (d < INT16_MIN)
+		d = INT16_MIN;
+	*q += d;
+	return d;
+}
+
+static void quantize(struct quant *q, const struct world *w) {
+	const struct ball *b;
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &w->balls[w->slot[i]];
+		q->pos[i][0] = lrintf(b->pos.x * POS_SCALE);
+		q->pos[i][1] = lrintf(b->pos.y * POS_SCALE);
+		q->vel[i][0] = lrintf(b->vel.x * VEL_SCALE);
+		q->vel[i][1] = lrintf(b->vel.y * VEL_SCALE);
+	}
+	for (i = 0; i < N_FLIPPERS; i++)
+		q->rot[i] = lrintf(w->flippers[i].rot * ROT_SCALE);
+}
+
+static void encode(struct delta *d) {
+	struct ball *b;
+	int i;
+
+	d->touch = 0;
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[world.slot[i]];
+		d->pos[i][0] = quant_step(&enc.pos[i][0], b->pos.x, POS_SCALE);
+		d->pos[i][1] = quant_step(&enc.pos[i][1], b->pos.y, POS_SCALE);
+		d->vel[i][0] = quant_step(&enc.vel[i][0], b->vel.x, VEL_SCALE);
+		d->vel[i][1] = quant_step(&enc.vel[i][1], b->vel.y, VEL_SCALE);
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		d->rot[i] = quant_step(&enc.rot[i], world.flippers[i].rot, ROT_SCALE);
+		if (world.flippers[i].touch_id >= 0)
+			d->touch |= 1U << i;
+	}
+}
+
+static struct world *key_at(uint64_t t) {
+	return &keys[t / KEY_INTERVAL % N_KEYS];
+}
+
+static struct delta *delta_at(uint64_t t) {
+	return &deltas[t % HIST_TICKS];
+}
+
+void hist_init(void) {
+	if (!keys) {
+		keys = malloc(N_KEYS * sizeof(*keys));
+		deltas = malloc(HIST_TICKS * sizeof(*deltas));
+		if (!keys || !deltas)
+			die("malloc: out of memory\n");
+	}
+	first = last = 0;
+	save_state(key_at(0));
+	quantize(&enc, &world);
+	encode(delta_at(0));
+}
+
+void hist_push(void) {
+	last++;
+	if (last % KEY_INTERVAL == 0) {
+		save_state(key_at(last));
+		quantize(&enc, &world);
+	}
+	encode(delta_at(last));
+	if (last - first >= HIST_TICKS - KEY_INTERVAL)
+		first += KEY_INTERVAL;
+}
+
+uint64_t hist_first(void) {
+	return first;
+}
+
+uint64_t hist_last(void) {
+	return last;
+}
+
+static uint64_t clamp_tick(uint64_t t) {
+	return t < first ? first : t > last ? last : t;
+}
+
+static void set_touch(struct world *w, const struct delta *d) {
+	int i;
+
+	for (i = 0; i < N_FLIPPERS; i++)
+		w->flippers[i].touch_id = d->touch >> i & 1 ? 0.0F : -1.0F;
+}
+
+static uint64_t reconstruct(uint64_t t, struct quant *q) {
+	struct delta *d;
+	uint64_t u;
+	int i;
+
+	u = t - t % KEY_INTERVAL;
+	quantize(q, key_at(u));
+	while (u++ < t) {
+		d = delta_at(u);
+		for (i = 0; i < N_BALLS; i++) {
+			q->pos[i][0] += d->pos[i][0];
+			q->pos[i][1] += d->pos[i][1];
+			q->vel[i][0] += d->vel[i][0];
+			q->vel[i][1] += d->vel[i][1];
+		}
+		for (i = 0; i < N_FLIPPERS; i++)
+			q->rot[i] += d->rot[i];
+	}
+	return t - t % KEY_INTERVAL;
+}
+
+void hist_preview(uint64_t t, struct world *w) {
+	struct ball *b;
+	struct quant q;
+	int i;
+
+	t = clamp_tick(t);
+	*w = *key_at(reconstruct(t, &q));
+	if (t % KEY_INTERVAL == 0)
+		return;
+	for (i = 0; i < N_BALLS; i++) {
+		b = &w->balls[w->slot[i]];
+		b->pos.x = q.pos[i][0] / POS_SCALE;
+		b->pos.y = q.pos[i][1] / POS_SCALE;
+		b->vel.x = q.vel[i][0] / VEL_SCALE;
+		b->vel.y = q.vel[i][1] / VEL_SCALE;
+	}
+	for (i = 0; i < N_FLIPPERS; i++)
+		w->flippers[i].rot = q.rot[i] / ROT_SCALE;
+	set_touch(w, delta_at(t));
+}
+
+void hist_seek(uint64_t t) {
+	uint64_t u;
+
+	t = clamp_tick(t);
+	u = reconstruct(t, &enc);
+	load_state(key_at(u));
+	while (u++ < t) {
+		set_touch(&world, delta_at(u));
+		simulate();
+	}
+	last = t;
+}
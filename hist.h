@@ -0,0 +1,19 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define HIST_SECONDS 300
+#define HIST_TICKS (HIST_SECONDS * FPS)
+#define KEY_INTERVAL FPS
+#define N_KEYS (HIST_TICKS / KEY_INTERVAL + 1)
+
+void hist_init(void);
+void hist_push(void);
+uint64_t hist_first(void);
+uint64_t hist_last(void);
+void hist_preview(uint64_t t, struct world *w);
+void hist_seek(uint64_t t);
+
+#endif
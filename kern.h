@@ -0,0 +1,237 @@
+#ifndef KERN_H
+#define KERN_H
+
+#include <limits.h>
+#include <math.h>
+#include "contact.h"
+#include "sim.h"
+
+struct segment {
+	struct vec2 a;
+	struct vec2 ab;
+	float a_ab;
+	float ab2;
+	int id;
+	int sided;
+	struct vec2 prev_ab;
+	int open_end;
+};
+
+struct sweep_hit {
+	float t;
+	struct vec2 n;
+	float push_vel;
+	int wall;
+};
+
+struct seg_hit {
+	float min_dist;
+	float t;
+	int id;
+	int sided;
+	struct vec2 disp;
+	struct vec2 n;
+};
+
+static inline struct vec2 perp(struct vec2 a) {
+	struct vec2 res;
+
+	res.x = -a.y;
+	res.y = a.x;
+	return res; 
+}
+
+static inline float dot(struct vec2 a, struct vec2 b) {
+	return a.x * b.x + a.y * b.y;
+}
+
+static inline float clamp(float v, float l, float h) {
+	return fmaxf(fminf(v, h), l);
+}
+
+static inline struct vec2 vec2_sub(struct vec2 a, struct vec2 b) { 
+	struct vec2 res;
+
+	res.x = a.x - b.x;
+	res.y = a.y - b.y;
+	return res;
+}
+
+static inline int line_segments(const struct polyline *l) {
+	return l->closed ? l->n : l->n - 1;
+}
+
+static inline void make_segment(struct segment *s, const struct vec2 *v,
+		const struct polyline *l, int i, int id) {
+	struct vec2 a;
+
+	a = v[l->first + i];
+	s->a = a;
+	s->ab = vec2_sub(v[l->first + (i + 1) % l->n], a);
+	s->a_ab = dot(a, s->ab);
+	s->ab2 = dot(s->ab, s->ab);
+	s->id = id;
+	s->sided = l->closed;
+	s->prev_ab.x = s->prev_ab.y = 0.0F;
+	if (l->closed || i > 0)
+		s->prev_ab = vec2_sub(a, v[l->first + (i + l->n - 1) % l->n]);
+	s->open_end = i == line_segments(l) - 1 && !l->closed;
+}
+
+static inline float ball_reach(const struct ball *b, float dt) {
+	return b->radius + sqrtf(dot(b->vel, b->vel)) * dt;
+}
+
+static inline float border_reach(const struct ball *b, float dt) {
+	float reach;
+
+	reach = ball_reach(b, dt);
+	return reach * reach;
+}
+
+static inline void seg_test(struct seg_hit *h, struct vec2 p,
+		const struct segment *s) {
+	float t, dx, dy, dist;
+
+	t = (p.x * s->ab.x + p.y * s->ab.y - s->a_ab) / s->ab2;
+	t = clamp(t, 0.0F, 1.0F);
+	dx = p.x - (s->a.x + s->ab.x * t);
+	dy = p.y - (s->a.y + s->ab.y * t);
+	dist = dx * dx + dy * dy;
+	if (dist < h->min_dist || (dist == h->min_dist && s->id < h->id)) {
+		h->min_dist = dist;
+		h->t = t;
+		h->id = s->id;
+		h->sided = s->sided;
+		h->disp.x = dx;
+		h->disp.y = dy;
+		h->n.x = -s->ab.y;
+		h->n.y = s->ab.x;
+	}
+}
+
+static inline void seg_contact(const struct seg_hit *h,
+		const struct ball *ball, int i) {
+	struct vec2 d;
+	float depth, dist;
+
+	if (h->id == INT_MAX)
+		return;
+	d = h->min_dist == 0.0F ? h->n : h->disp;
+	dist = sqrtf(dot(d, d));
+	d.x /= dist;
+	d.y /= dist;
+	if (h->sided && dot(d, h->n) < 0.0F) {
+		d.x = -d.x;
+		d.y = -d.y;
+		depth = ball->radius + dist;
+	} else if (dist > ball->radius) {
+		return;
+	} else {
+		depth = ball->radius - dist;
+	}
+	contact_add(i, -1, FEATURE(FEATURE_WALL, h->id), d, depth,
+			fabsf(dot(ball->vel, d)) * ball->restitution);
+}
+
+static inline void seg_border(const struct ball *ball, int i, float reach2,
+		const struct segment *s) {
+	struct seg_hit h;
+
+	h.min_dist = reach2;
+	h.id = INT_MAX;
+	seg_test(&h, ball->pos, s);
+	if (h.id == INT_MAX)
+		return;
+	if (h.t == 0.0F && dot(h.disp, s->prev_ab) < 0.0F)
+		return;
+	if (h.t == 1.0F && !s->open_end)
+		return;
+	seg_contact(&h, ball, i);
+}
+
+static inline float sweep_circle(struct vec2 p, struct vec2 d,
+		struct vec2 c, float r) {
+	struct vec2 m;
+	float a, b, k, disc;
+
+	m = vec2_sub(p, c);
+	k = dot(m, m) - r * r;
+	b = dot(m, d);
+	if (k <= 0.0F || b >= 0.0F)
+		return INFINITY;
+	a = dot(d, d);
+	disc = b * b - a * k;
+	if (disc < 0.0F)
+		return INFINITY;
+	return (-b - sqrtf(disc)) / a;
+}
+
+static inline void sweep_point(struct sweep_hit *h, struct vec2 p,
+		struct vec2 d, struct vec2 c, float r, int wall, float push_vel) {
+	struct vec2 n;
+	float t, len;
+
+	t = sweep_circle(p, d, c, r);
+	if (t >= h->t)
+		return;
+	n.x = p.x + d.x * t - c.x;
+	n.y = p.y + d.y * t - c.y;
+	len = sqrtf(dot(n, n));
+	h->t = t;
+	h->n.x = n.x / len;
+	h->n.y = n.y / len;
+	h->push_vel = push_vel;
+	h->wall = wall;
+}
+
+static inline void sweep_segment(struct sweep_hit *h, struct vec2 p,
+		struct vec2 d, float r, const struct segment *s) {
+	struct vec2 n, b;
+	float len, dist, dn, t, u;
+
+	len = sqrtf(s->ab2);
+	n.x = -s->ab.y / len;
+	n.y = s->ab.x / len;
+	dist = dot(vec2_sub(p, s->a), n);
+	if (dist < 0.0F) {
+		if (s->sided)
+			return;
+		n.x = -n.x;
+		n.y = -n.y;
+		dist = -dist;
+	}
+	dn = dot(d, n);
+	if (dist > r && dn < 0.0F) {
+		t = (dist - r) / -dn;
+		u = ((p.x + d.x * t) * s->ab.x + (p.y + d.y * t) * s->ab.y -
+			s->a_ab) / s->ab2;
+		if (t < h->t && u >= 0.0F && u <= 1.0F) {
+			h->t = t;
+			h->n = n;
+			h->wall = 1;
+		}
+	}
+	b.x = s->a.x + s->ab.x;
+	b.y = s->a.y + s->ab.y;
+	sweep_point(h, p, d, s->a, r, 1, 0.0F);
+	sweep_point(h, p, d, b, r, 1, 0.0F);
+}
+
+static inline void obstacle_hit(const struct ball *a, int i, int id,
+		float radius, float x, float y, float push_vel) {
+	struct vec2 v;
+	float s;
+
+	v.x = a->pos.x - x;
+	v.y = a->pos.y - y;
+	s = sqrtf(dot(v, v));
+	if (s == 0.0F || s > a->radius + radius)
+		return;
+	v.x /= s;
+	v.y /= s;
+	contact_add(i, -1, FEATURE(FEATURE_OBSTACLE, id), v,
+			a->radius + radius - s, push_vel);
+}
+
+#endif
@@ -0,0 +1,9 @@
+#include <stddef.h>
+#include "sim.h"
+
+extern const struct kernel kernel_default;
+
+const struct kernel *const kernels[] = {
+	&kernel_default,
+	NULL
+};
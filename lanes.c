@@ -0,0 +1,344 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include "draw.h"
+#include "kern.h"
+#include "lanes.h"
+#include "pool.h"
+
+struct lane_geom {
+	lane_f ab_x;
+	lane_f ab_y;
+	lane_f a_ab;
+	lane_f ab2;
+	lane_f wvel;
+};
+
+static struct segment *segs;
+static int n_segs;
+static const uint8_t *branch_input;
+static int branch_ticks;
+
+static lane_f splat(float v) {
+	lane_f r = {0};
+
+	return r + v;
+}
+
+static lane_f lane_select(lane_i m, lane_f a, lane_f b) {
+	return (lane_f) ((m & (lane_i) a) | (~m & (lane_i) b));
+}
+
+static lane_f lane_min(lane_f a, lane_f b) {
+	return lane_select(a < b, a, b);
+}
+
+static lane_f lane_max(lane_f a, lane_f b) {
+	return lane_select(a > b, a, b);
+}
+
+static lane_f lane_sqrt(lane_f v) {
+#ifdef __AVX__
+	return (lane_f) _mm256_sqrt_ps((__m256) v);
+#else
+	int k;
+
+	for (k = 0; k < LANES; k++)
+		v[k] = sqrtf(v[k]);
+	return v;
+#endif
+}
+
+void lanes_init(void) {
+	const struct polyline *l;
+	int i;
+
+	n_segs = 0;
+	for (l = table.lines; l < table.lines + table.n_lines; l++)
+		n_segs += line_segments(l);
+	free(segs);
+	segs = malloc(n_segs * sizeof(*segs));
+	if (!segs)
+		die("malloc: out of memory\n");
+	n_segs = 0;
+	for (l = table.lines; l < table.lines + table.n_lines; l++) {
+		for (i = 0; i < line_segments(l); i++) {
+			make_segment(&segs[n_segs], table.border, l, i, n_segs);
+			n_segs++;
+		}
+	}
+}
+
+struct lane_world *lanes_alloc(int n_groups) {
+	struct lane_world *l;
+
+	l = aligned_alloc(sizeof(lane_f), n_groups * sizeof(*l));
+	if (!l)
+		die("aligned_alloc: out of memory\n");
+	memset(l, 0, n_groups * sizeof(*l));
+	return l;
+}
+
+void lanes_fork(struct lane_world *l, int n_groups, const struct world *w) {
+	lane_f *v;
+	size_t i;
+
+	lanes_load(l, 0, w);
+	v = (lane_f *) l;
+	for (i = 0; i < sizeof(*l) / sizeof(*v); i++)
+		v[i] = splat(v[i][0]);
+	for (i = 1; i < (size_t) n_groups; i++)
+		memcpy(&l[i], l, sizeof(*l));
+}
+
+void lanes_load(struct lane_world *l, int lane, const struct world *w) {
+	const struct ball *b;
+	struct lane_ball *lb;
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &w->balls[w->slot[i]];
+		lb = &l->balls[i];
+		lb->radius[lane] = b->radius;
+		lb->mass[lane] = b->mass;
+		lb->restitution[lane] = b->restitution;
+		lb->pos_x[lane] = b->pos.x;
+		lb->pos_y[lane] = b->pos.y;
+		lb->vel_x[lane] = b->vel.x;
+		lb->vel_y[lane] = b->vel.y;
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		l->flippers[i].rot[lane] = w->flippers[i].rot;
+		l->flippers[i].cur_wvel[lane] = w->flippers[i].cur_wvel;
+		l->flippers[i].touch_id[lane] = w->flippers[i].touch_id;
+	}
+}
+
+void lanes_store(const struct lane_world *l, int lane, struct world *w) {
+	const struct lane_ball *lb;
+	struct ball *b;
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &w->balls[w->slot[i]];
+		lb = &l->balls[i];
+		b->pos.x = lb->pos_x[lane];
+		b->pos.y = lb->pos_y[lane];
+		b->vel.x = lb->vel_x[lane];
+		b->vel.y = lb->vel_y[lane];
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		w->flippers[i].rot = l->flippers[i].rot[lane];
+		w->flippers[i].cur_wvel = l->flippers[i].cur_wvel[lane];
+		w->flippers[i].touch_id = l->flippers[i].touch_id[lane];
+	}
+}
+
+static void hit(struct lane_ball *b, lane_i m, lane_f nx, lane_f ny,
+		lane_f depth, lane_f target) {
+	lane_f j;
+
+	depth = lane_select(m, depth, splat(0.0F));
+	b->pos_x += nx * depth;
+	b->pos_y += ny * depth;
+	j = target - (b->vel_x * nx + b->vel_y * ny);
+	j = lane_select(m & (j > 0.0F), j, splat(0.0F));
+	b->vel_x += nx * j;
+	b->vel_y += ny * j;
+}
+
+static void lane_ball_ball(struct lane_ball *a, struct lane_ball *b) {
+	lane_f nx, ny, d, depth, rest, vrel, j;
+	lane_i m;
+
+	nx = a->pos_x - b->pos_x;
+	ny = a->pos_y - b->pos_y;
+	d = lane_sqrt(nx * nx + ny * ny);
+	m = (d > 0.0F) & (d <= a->radius + b->radius);
+	d = lane_select(m, d, splat(1.0F));
+	nx /= d;
+	ny /= d;
+	depth = (a->radius + b->radius - d) / 2.0F;
+	depth = lane_select(m, depth, splat(0.0F));
+	a->pos_x += nx * depth;
+	a->pos_y += ny * depth;
+	b->pos_x -= nx * depth;
+	b->pos_y -= ny * depth;
+	rest = lane_min(a->restitution, b->restitution);
+	vrel = (a->vel_x - b->vel_x) * nx + (a->vel_y - b->vel_y) * ny;
+	j = (-rest * vrel - vrel) / (1.0F / a->mass + 1.0F / b->mass);
+	j = lane_select(m & (j > 0.0F), j, splat(0.0F));
+	a->vel_x += nx * j / a->mass;
+	a->vel_y += ny * j / a->mass;
+	b->vel_x -= nx * j / b->mass;
+	b->vel_y -= ny * j / b->mass;
+}
+
+static void lane_obstacles(struct lane_ball *b) {
+	const struct obstacle *o;
+	lane_f nx, ny, s;
+	lane_i m;
+
+	for (o = table.obstacles; o < table.obstacles + table.n_obstacles; o++) {
+		nx = b->pos_x - o->pos.x;
+		ny = b->pos_y - o->pos.y;
+		s = lane_sqrt(nx * nx + ny * ny);
+		m = (s > 0.0F) & (s <= b->radius + o->radius);
+		s = lane_select(m, s, splat(1.0F));
+		hit(b, m, nx / s, ny / s, b->radius + o->radius - s,
+				splat(o->push_vel));
+	}
+}
+
+static void lane_flipper(struct lane_ball *b, const struct flipper *f,
+		const struct lane_geom *g) {
+	lane_f s, cx, cy, dx, dy, px, py;
+	lane_i m;
+
+	s = (b->pos_x * g->ab_x + b->pos_y * g->ab_y - g->a_ab) / g->ab2;
+	s = lane_min(lane_max(s, splat(0.0F)), splat(1.0F));
+	cx = f->pos.x + g->ab_x * s;
+	cy = f->pos.y + g->ab_y * s;
+	dx = b->pos_x - cx;
+	dy = b->pos_y - cy;
+	s = lane_sqrt(dx * dx + dy * dy);
+	m = (s > 0.0F) & (s <= b->radius + f->radius);
+	s = lane_select(m, s, splat(1.0F));
+	dx /= s;
+	dy /= s;
+	px = (cx + dx * f->radius - f->pos.x) * g->wvel;
+	py = (cy + dy * f->radius - f->pos.y) * g->wvel;
+	hit(b, m, dx, dy, b->radius + f->radius - s, -py * dx + px * dy);
+}
+
+static void lane_border(struct lane_ball *b, float dt) {
+	const struct segment *sg;
+	lane_f reach, min, t, dx, dy, d2, nx, ny, hx, hy, dist, depth, v;
+	lane_i upd, found, sided, out;
+
+	reach = b->radius + lane_sqrt(b->vel_x * b->vel_x +
+			b->vel_y * b->vel_y) * dt;
+	min = reach * reach;
+	found = sided = (lane_i) {0};
+	nx = ny = hx = hy = splat(0.0F);
+	for (sg = segs; sg < segs + n_segs; sg++) {
+		t = (b->pos_x * sg->ab.x + b->pos_y * sg->ab.y - sg->a_ab) /
+			sg->ab2;
+		t = lane_min(lane_max(t, splat(0.0F)), splat(1.0F));
+		dx = b->pos_x - (sg->a.x + sg->ab.x * t);
+		dy = b->pos_y - (sg->a.y + sg->ab.y * t);
+		d2 = dx * dx + dy * dy;
+		upd = d2 < min;
+		min = lane_select(upd, d2, min);
+		hx = lane_select(upd, dx, hx);
+		hy = lane_select(upd, dy, hy);
+		nx = lane_select(upd, splat(-sg->ab.y), nx);
+		ny = lane_select(upd, splat(sg->ab.x), ny);
+		sided = (upd & -sg->sided) | (~upd & sided);
+		found |= upd;
+	}
+	upd = min == 0.0F;
+	hx = lane_select(upd, nx, hx);
+	hy = lane_select(upd, ny, hy);
+	dist = lane_sqrt(hx * hx + hy * hy);
+	dist = lane_select(found, dist, splat(1.0F));
+	hx /= dist;
+	hy /= dist;
+	out = sided & (hx * nx + hy * ny < 0.0F);
+	hx = lane_select(out, -hx, hx);
+	hy = lane_select(out, -hy, hy);
+	depth = lane_select(out, b->radius + dist, b->radius - dist);
+	v = b->vel_x * hx + b->vel_y * hy;
+	v = lane_select(v < 0.0F, -v, v);
+	hit(b, found & (out | (dist <= b->radius)), hx, hy, depth,
+			v * b->restitution);
+}
+
+static void lane_step(struct lane_world *l, float dt) {
+	const struct flipper *f;
+	struct lane_flipper *lf;
+	struct lane_geom geom[N_FLIPPERS];
+	struct lane_ball *b;
+	lane_f prev, rot;
+	int i, j, k;
+
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		lf = &l->flippers[i];
+		prev = lf->rot;
+		lf->rot = lane_select(lf->touch_id < 0.0F,
+				lane_max(lf->rot - dt * f->wvel, splat(0.0F)),
+				lane_min(lf->rot + dt * f->wvel,
+					splat(f->max_rot)));
+		lf->cur_wvel = f->sign * (prev - lf->rot) / dt;
+		rot = -(f->rest_rad + f->sign * lf->rot);
+		for (k = 0; k < LANES; k++) {
+			geom[i].ab_x[k] = cosf(rot[k]) * f->length;
+			geom[i].ab_y[k] = sinf(rot[k]) * f->length;
+		}
+		geom[i].a_ab = f->pos.x * geom[i].ab_x + f->pos.y * geom[i].ab_y;
+		geom[i].ab2 = geom[i].ab_x * geom[i].ab_x +
+			geom[i].ab_y * geom[i].ab_y;
+		geom[i].wvel = lf->cur_wvel;
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		b = &l->balls[i];
+		b->vel_x += gravity.x * dt;
+		b->vel_y += gravity.y * dt;
+		b->pos_x += b->vel_x * dt;
+		b->pos_y += b->vel_y * dt;
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		for (j = i + 1; j < N_BALLS; j++)
+			lane_ball_ball(&l->balls[i], &l->balls[j]);
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		b = &l->balls[i];
+		lane_obstacles(b);
+		for (j = 0; j < N_FLIPPERS; j++)
+			lane_flipper(b, &world.flippers[j], &geom[j]);
+		lane_border(b, dt);
+	}
+}
+
+static void lane_tick(void *arg, int i) {
+	struct lane_world *l;
+	int n;
+
+	l = (struct lane_world *) arg + i;
+	for (n = 0; n < max_substeps; n++)
+		lane_step(l, DT / max_substeps);
+}
+
+void lanes_simulate(struct lane_world *l, int n_groups) {
+	pool_run(lane_tick, l, n_groups);
+}
+
+static void branch_tick(void *arg, int i) {
+	struct lane_world *l;
+	const uint8_t *in;
+	int t, k, f, n;
+
+	l = (struct lane_world *) arg + i;
+	in = branch_input + (size_t) i * LANES * branch_ticks;
+	for (t = 0; t < branch_ticks; t++) {
+		for (k = 0; k < LANES; k++) {
+			for (f = 0; f < N_FLIPPERS; f++)
+				l->flippers[f].touch_id[k] =
+					in[k * branch_ticks + t] >> f & 1 ?
+					0.0F : -1.0F;
+		}
+		for (n = 0; n < max_substeps; n++)
+			lane_step(l, DT / max_substeps);
+	}
+}
+
+void lanes_branch(struct lane_world *l, int n_groups, int ticks,
+		const uint8_t *input) {
+	branch_input = input;
+	branch_ticks = ticks;
+	pool_run(branch_tick, l, n_groups);
+}
@@ -0,0 +1,42 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define LANES 8
+
+typedef float lane_f __attribute__((vector_size(LANES * sizeof(float))));
+typedef int32_t lane_i __attribute__((vector_size(LANES * sizeof(int32_t))));
+
+struct lane_ball {
+	lane_f radius;
+	lane_f mass;
+	lane_f restitution;
+	lane_f pos_x;
+	lane_f pos_y;
+	lane_f vel_x;
+	lane_f vel_y;
+};
+
+struct lane_flipper {
+	lane_f rot;
+	lane_f cur_wvel;
+	lane_f touch_id;
+};
+
+struct lane_world {
+	struct lane_ball balls[N_BALLS];
+	struct lane_flipper flippers[N_FLIPPERS];
+};
+
+void lanes_init(void);
+struct lane_world *lanes_alloc(int n_groups);
+void lanes_fork(struct lane_world *l, int n_groups, const struct world *w);
+void lanes_load(struct lane_world *l, int lane, const struct world *w);
+void lanes_store(const struct lane_world *l, int lane, struct world *w);
+void lanes_simulate(struct lane_world *l, int n_groups);
+void lanes_branch(struct lane_world *l, int n_groups, int ticks,
+		const uint8_t *input);
+
+#endif
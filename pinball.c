@@ -1,14 +1,30 @@
 #include <SDL2/SDL.h>
 #include <glad/gl.h>
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavutil/opt.h>
-#include <libswscale/swscale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "contact.h"
 #include "draw.h"
+#include "event.h"
+#include "hist.h"
+#include "lanes.h"
+#include "pool.h"
+#include "rec.h"
+#include "replay.h"
+#include "sdf.h"
+#include "shm.h"
+#include "table.h"
 #include "sim.h"
 
 #define WIDTH 500
 #define HEIGHT 850 
+#define SUBPIXEL 4.0F
+#define MC_JITTER 0.1F
+#define MAX_REPEAT FPS
+#define SCRUB_SPEED 4
+#define BRANCH_TICKS FPS
+#define BRANCH_HOLD (FPS / 4)
 
 static int w, h;
 
@@ -23,26 +39,9 @@ static int select_flipper(struct flipper *f, struct vec2 pos) {
 }
 
 static uint8_t pixels[WIDTH * HEIGHT * 3];
-static const char path[] = "pinball.mp4";
-
-static void encode(AVCodecContext *cctx, AVFrame *frame,
-	       AVPacket *pkt, AVFormatContext *fmtctx, AVStream *vid) {
-	int ret;
-
-	ret = avcodec_send_frame(cctx, frame);
-	if (ret < 0)
-		die("avcodec_send_frame: %s\n", av_err2str(ret));
-	while (ret >= 0) {
-		ret = avcodec_receive_packet(cctx, pkt);
-		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) 
-			return;
-		if (ret < 0)
-			die("avcodec_receive_packet: %s\n", ret);
-		av_packet_rescale_ts(pkt, cctx->time_base, vid->time_base);
-		av_write_frame(fmtctx, pkt);
-		av_packet_unref(pkt);
-	}
-}
+static struct rendition rends[MAX_RENDITIONS] = {
+	{WIDTH, HEIGHT, 200000, NULL, "pinball.mp4", 0, 0}
+};
 
 static void add_touch(int x, int y) {
 	int i;
@@ -52,7 +51,7 @@ static void add_touch(int x, int y) {
 	sv.x = x / (float) w; 
 	sv.y = 1.7F - y / (float) h * 1.7F; 
 	for (i = 0; i < N_FLIPPERS; i++) {
-		f = &flippers[i];
+		f = &world.flippers[i];
 		if (select_flipper(f, sv)) 
 			f->touch_id = 0;
 	}
@@ -63,11 +62,168 @@ static void del_touch(void) {
 	struct flipper *f;
 
 	for (i = 0; i < N_FLIPPERS; i++) {
-		f = &flippers[i];
+		f = &world.flippers[i];
 		f->touch_id = -1;
 	}
 }
 
+static void hash_int(uint64_t *h, int v) {
+	*h ^= (uint32_t) v;
+	*h *= 0x100000001B3ULL;
+}
+
+static uint64_t frame_key(void) {
+	const struct ball *b;
+	struct flipper *f;
+	uint64_t h;
+	float s;
+	int i;
+
+	h = 0xCBF29CE484222325ULL;
+	s = HEIGHT / 1.7F * SUBPIXEL;
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[world.slot[i]];
+		hash_int(&h, lrintf(b->pos.x * s));
+		hash_int(&h, lrintf(b->pos.y * s));
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		hash_int(&h, lrintf(f->rot * f->length * s));
+	}
+	return h;
+}
+
+static uint64_t scrub_tick(uint64_t t, int dir) {
+	if (dir < 0)
+		return t - hist_first() > SCRUB_SPEED ? 
+			t - SCRUB_SPEED : hist_first();
+	if (dir > 0)
+		return hist_last() - t > SCRUB_SPEED ? 
+			t + SCRUB_SPEED : hist_last();
+	return t;
+}
+
+static float mc_noise(uint32_t *seed) {
+	*seed = *seed * 1103515245U + 12345U;
+	return (*seed >> 8) / 16777216.0F - 0.5F;
+}
+
+static void run_worlds(long ticks, int n) {
+	struct lane_world *l;
+	struct world w;
+	struct ball *b;
+	uint32_t seed;
+	long t;
+	int i, k, n_groups;
+
+	lanes_init();
+	n_groups = (n + LANES - 1) / LANES;
+	l = lanes_alloc(n_groups);
+	for (k = 0; k < n_groups * LANES; k++) {
+		w = world;
+		seed = k;
+		for (i = 0; k > 0 && k < n && i < N_BALLS; i++) {
+			w.balls[i].vel.x += MC_JITTER * mc_noise(&seed);
+			w.balls[i].vel.y += MC_JITTER * mc_noise(&seed);
+		}
+		lanes_load(&l[k / LANES], k % LANES, &w);
+	}
+	for (t = 0; t < ticks; t++)
+		lanes_simulate(l, n_groups);
+	for (k = 0; k < n; k++) {
+		lanes_store(&l[k / LANES], k % LANES, &w);
+		for (i = 0; i < N_BALLS; i++) {
+			b = &w.balls[w.slot[i]];
+			printf("%d %d %g %g %g %g\n", k, i, b->pos.x, b->pos.y,
+					b->vel.x, b->vel.y);
+		}
+	}
+	free(l);
+}
+
+static float branch_score(const struct world *w) {
+	float s;
+	int i;
+
+	s = 0.0F;
+	for (i = 0; i < N_BALLS; i++)
+		s += w->balls[i].pos.y;
+	return s;
+}
+
+static float step_branch(const uint8_t *in) {
+	struct world live;
+	float s;
+	int i, t;
+
+	save_state(&live);
+	for (t = 0; t < BRANCH_TICKS; t++) {
+		for (i = 0; i < N_FLIPPERS; i++)
+			world.flippers[i].touch_id = in[t] >> i & 1 ? 0.0F : -1.0F;
+		simulate();
+	}
+	s = branch_score(&world);
+	load_state(&live);
+	return s;
+}
+
+static void run_branches(int n) {
+	struct lane_world *l;
+	struct world w;
+	uint8_t *input, *in;
+	uint32_t seed;
+	float s, best_s;
+	int i, k, t, best, n_groups, start[N_FLIPPERS];
+
+	lanes_init();
+	n_groups = (n + LANES - 1) / LANES;
+	l = lanes_alloc(n_groups);
+	input = calloc(n_groups * LANES, BRANCH_TICKS);
+	if (!input)
+		die("calloc: out of memory\n");
+	for (k = 1; k < n; k++) {
+		seed = k;
+		in = input + k * BRANCH_TICKS;
+		for (i = 0; i < N_FLIPPERS; i++)
+			start[i] = (mc_noise(&seed) + 0.5F) * BRANCH_TICKS;
+		for (t = 0; t < BRANCH_TICKS; t++) {
+			for (i = 0; i < N_FLIPPERS; i++) {
+				if (t >= start[i] && t < start[i] + BRANCH_HOLD)
+					in[t] |= 1U << i;
+			}
+		}
+	}
+	lanes_fork(l, n_groups, &world);
+	lanes_branch(l, n_groups, BRANCH_TICKS, input);
+	w = world;
+	best = 0;
+	best_s = -INFINITY;
+	for (k = 0; k < n; k++) {
+		lanes_store(&l[k / LANES], k % LANES, &w);
+		s = branch_score(&w);
+		if (s > best_s) {
+			best = k;
+			best_s = s;
+		}
+	}
+	in = input + best * BRANCH_TICKS;
+	printf("%d %g %g", best, best_s, step_branch(in));
+	for (t = 0; t < BRANCH_TICKS; t++)
+		printf(" %d", in[t]);
+	printf("\n");
+	free(input);
+	free(l);
+}
+
+static void run_ticks(long n, int events) {
+	if (events) {
+		simulate_ticks(n);
+		return;
+	}
+	while (n-- > 0)
+		simulate();
+}
+
 static void render(void) {
 
 }
@@ -82,19 +238,133 @@ int main(int argc, char **argv) {
 	SDL_Event ev;
 	GLuint fbo;
 	GLuint tex;
-	struct SwsContext *sws;
 	const uint8_t *src;
 	int src_stride;
-	const AVOutputFormat *outfmt;
-	AVFormatContext *fmtctx;
-	int ret;
-	const AVCodec *codec;
-	AVStream *vid;
-	AVCodecContext *cctx;
-	AVPacket *pkt;
-	AVFrame *frame;
+	int n_rends;
 	int fi;
+	int last_fi;
+	uint64_t key, last_key;
+	int paused, scrub;
+	uint64_t st;
+	const char *shm_name, *replay_path, *verify_path;
+	struct shm_ring *ring;
+	float sdf_res;
+	long headless;
+	const struct ball *b;
+	int i, opt, sdf_check, threads, n_worlds, n_branches, events;
 
+	shm_name = replay_path = verify_path = NULL;
+	sdf_res = 0.0F;
+	sdf_check = 0;
+	headless = 0;
+	threads = 0;
+	n_worlds = n_branches = events = 0;
+	while ((opt = getopt(argc, argv, "s:t:d:xn:i:wj:z:FH:eM:B:r:V:")) != -1) {
+		switch (opt) {
+		case 'd':
+			sdf_res = atof(optarg);
+			break;
+		case 'x':
+			sdf_check = 1;
+			break;
+		case 'n':
+			max_substeps = atoi(optarg);
+			if (max_substeps < 1)
+				die("%s: bad substep cap\n", argv[0]);
+			break;
+		case 'i':
+			solver_iterations = atoi(optarg);
+			if (solver_iterations < 1)
+				die("%s: bad solver iterations\n", argv[0]);
+			break;
+		case 'w':
+			warm_start = 1;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'z':
+			sort_interval = atoi(optarg);
+			break;
+		case 'F':
+			fixed_mode = 1;
+			break;
+		case 'H':
+			headless = atol(optarg);
+			break;
+		case 'e':
+			events = 1;
+			break;
+		case 'M':
+			n_worlds = atoi(optarg);
+			if (n_worlds < 1)
+				die("%s: bad world count\n", argv[0]);
+			break;
+		case 'B':
+			n_branches = atoi(optarg);
+			if (n_branches < 1)
+				die("%s: bad branch count\n", argv[0]);
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'V':
+			verify_path = optarg;
+			break;
+		case 's':
+			shm_name = optarg;
+			break;
+		case 't':
+			load_table(optarg);
+			break;
+		default:
+			die("usage: %s [-s shm] [-t table.tblb] [-d res [-x]] [-n substeps] "
+				"[-i iterations] [-w] [-j threads] [-z ticks] [-F] "
+				"[-H ticks [-e] [-M worlds | -B branches (approximate)]] "
+				"[-r replay] [-V replay] "
+				"[WxH:bitrate:codec:path]...\n", argv[0]);
+		}
+	}
+	pool_init(threads);
+	init_table();
+	if (sdf_res > 0.0F)
+		sdf_init(sdf_res, sdf_check);
+	if (verify_path)
+		return replay_verify(verify_path);
+	if (headless > 0 && n_worlds > 0) {
+		run_worlds(headless, n_worlds);
+		return 0;
+	}
+	if (headless > 0 && n_branches > 0) {
+		run_ticks(headless, events);
+		run_branches(n_branches);
+		return 0;
+	}
+	if (replay_path)
+		replay_record(replay_path);
+	if (headless > 0 && replay_path) {
+		while (headless-- > 0) {
+			simulate();
+			replay_push();
+		}
+		replay_close();
+		return 0;
+	}
+	if (headless > 0) {
+		run_ticks(headless, events);
+		for (i = 0; i < N_BALLS; i++) {
+			b = &world.balls[world.slot[i]];
+			printf("%d %g %g %g %g\n", i, b->pos.x, b->pos.y,
+					b->vel.x, b->vel.y);
+		}
+		return 0;
+	}
+	n_rends = optind < argc ? argc - optind : 1;
+	if (n_rends > MAX_RENDITIONS)
+		die("%s: too many renditions\n", argv[0]);
+	for (i = optind; i < argc; i++)
+		parse_rendition(&rends[i - optind], argv[i]);
+	ring = shm_name ? shm_create(shm_name) : NULL;
 	if (SDL_Init(SDL_INIT_EVERYTHING))
 		die("SDL_Init: %s\n", SDL_GetError());
 	if (atexit(SDL_Quit))
@@ -125,69 +395,19 @@ int main(int argc, char **argv) {
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != 
 			GL_FRAMEBUFFER_COMPLETE)
 		die("glCheckFramebufferStatus: %u\n", glGetError());
-	sws = sws_getContext(WIDTH, HEIGHT, AV_PIX_FMT_RGB24,
-		WIDTH, HEIGHT, AV_PIX_FMT_YUV420P, 0,
-		NULL, NULL, NULL);
-	if (!sws)
-		die("sws_getContext\n");
 	src = pixels + WIDTH * 3 * (HEIGHT - 1);
 	src_stride = -WIDTH * 3;
-	outfmt = av_guess_format(NULL, path, NULL);
-	if (!outfmt)
-		die("av_guess_format\n");
-	ret = avformat_alloc_output_context2(&fmtctx, outfmt, NULL, path);
-	if (ret < 0)
-		die("avformat_free_context: %s\n", av_err2str(ret));
-	codec = avcodec_find_encoder(outfmt->video_codec);
-	if (!codec)
-		die("avcodec_find_encoder\n");
-	vid = avformat_new_stream(fmtctx, codec);
-	if (!vid)
-		die("avformat_new_stream\n");
-	cctx = avcodec_alloc_context3(codec);
-	if (!cctx)
-		die("avcodec_alloc_context3\n");
-	vid->codecpar->codec_id = outfmt->video_codec;
-	vid->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-	vid->codecpar->width = WIDTH;
-	vid->codecpar->height = HEIGHT;
-	vid->codecpar->format = AV_PIX_FMT_YUV420P;
-	vid->codecpar->bit_rate = 200000;
-        av_opt_set(cctx, "preset", "ultrafast", 0);
-	avcodec_parameters_to_context(cctx, vid->codecpar);
-	cctx->time_base.num = 1; 
-	cctx->time_base.den = FPS; 
-	cctx->framerate.num = FPS; 
-	cctx->framerate.den = 1; 
-	cctx->gop_size = FPS * 10;
-	cctx->max_b_frames = 1;
-	avcodec_parameters_from_context(vid->codecpar, cctx);
-	ret = avcodec_open2(cctx, codec, NULL);
-	if (ret < 0)
-		die("avcodec_open2: %s\n", av_err2str(ret));
-	ret = avio_open(&fmtctx->pb, path, AVIO_FLAG_WRITE);
-	if (ret < 0)
-		die("avio_open: %s\n", av_err2str(ret));
-    	ret = avformat_write_header(fmtctx, NULL);
-	if (ret < 0)
-		die("avformat_write_header: %s\n", av_err2str(ret));
-	pkt = av_packet_alloc();
-	if (!pkt)
-		die("av_packet_alloc\n");
-	frame = av_frame_alloc();
-	if (!frame)
-		die("av_frame_alloc\n");
-	frame->format = AV_PIX_FMT_YUV420P;	
-	frame->width = WIDTH;
-	frame->height = HEIGHT;
-	ret = av_frame_get_buffer(frame, 0);
-	if (ret < 0)
-		die("av_frame_get_buffer: %s\n", av_err2str(ret));
+	rec_open(rends, n_rends, WIDTH, HEIGHT);
 	SDL_ShowWindow(wnd);
 	w0 = h0 = 0;
 	t0 = SDL_GetPerformanceCounter();
 	acc = 0.0F;
 	fi = 0;
+	last_fi = -1;
+	last_key = 0;
+	paused = scrub = 0;
+	st = 0;
+	hist_init();
 	while (!SDL_QuitRequested()) {
 		SDL_GetWindowSize(wnd, &w, &h);
 		while (SDL_PollEvent(&ev)) {
@@ -198,6 +418,33 @@ int main(int argc, char **argv) {
 			case SDL_MOUSEBUTTONUP:
 				del_touch();
 				break;
+			case SDL_KEYDOWN:
+				if (ev.key.repeat)
+					break;
+				switch (ev.key.keysym.sym) {
+				case SDLK_LEFT:
+					if (!paused)
+						st = hist_last();
+					paused = 1;
+					scrub = -1;
+					break;
+				case SDLK_RIGHT:
+					scrub = paused;
+					break;
+				case SDLK_SPACE:
+					if (paused)
+						hist_seek(st);
+					if (paused && replay_path)
+						replay_load();
+					paused = scrub = 0;
+					break;
+				}
+				break;
+			case SDL_KEYUP:
+				if (ev.key.keysym.sym == SDLK_LEFT ||
+				    ev.key.keysym.sym == SDLK_RIGHT)
+					scrub = 0;
+				break;
 			}
 		}
 		t1 = SDL_GetPerformanceCounter();
@@ -209,33 +456,41 @@ int main(int argc, char **argv) {
 		w0 = w1;
 		h0 = h1;
 		acc += dt;
-		if (acc >= DT) {
+		if (acc >= DT && paused) {
+			acc -= DT;
+			st = scrub_tick(st, scrub);
+			hist_preview(st, &world);
+		} else if (acc >= DT) {
 			acc -= DT;
-			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-			ret = av_frame_make_writable(frame);
-			if (ret < 0)
-				die("av_frame_make_writable: %s\n", 
-						av_err2str(ret));
 			simulate();
-			draw();
-			glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, 
-					GL_UNSIGNED_BYTE, pixels); 
-			ret = sws_scale(sws, &src,
-					&src_stride, 0, HEIGHT, 
-					frame->data, frame->linesize);
-			frame->pts = fi++;
-			encode(cctx, frame, pkt, fmtctx, vid);
+			hist_push();
+			if (replay_path)
+				replay_push();
+			if (ring)
+				shm_publish(ring, fi);
+			key = frame_key();
+			if (last_fi < 0 || key != last_key) {
+				glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+				draw();
+				glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, 
+						GL_UNSIGNED_BYTE, pixels); 
+				rec_frame(src, src_stride, fi);
+				last_fi = fi;
+				last_key = key;
+			} else if (fi - last_fi >= MAX_REPEAT) {
+				rec_repeat(fi);
+				last_fi = fi;
+			}
+			fi++;
 		}
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		draw();
 		SDL_GL_SwapWindow(wnd);
 	}
-	encode(cctx, NULL, pkt, fmtctx, vid);
-	av_frame_free(&frame);
-	av_packet_free(&pkt);
-	av_write_trailer(fmtctx);
-	avio_close(fmtctx->pb);
-	avcodec_free_context(&cctx);
-	avformat_free_context(fmtctx);
+	rec_close(fi);
+	if (replay_path)
+		replay_close();
+	if (ring)
+		shm_destroy(ring, shm_name);
 	return 0;
 }
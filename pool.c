@@ -0,0 +1,86 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "draw.h"
+#include "pool.h"
+
+#define MAX_THREADS 256
+
+static pthread_t threads[MAX_THREADS];
+static int n_threads;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static unsigned gen;
+static int n_done;
+static void (*job_fn)(void *, int);
+static void *job_arg;
+static int job_n;
+static int next;
+
+static void run_items(void) {
+	int i;
+
+	while ((i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < job_n)
+		job_fn(job_arg, i);
+}
+
+static void *worker(void *arg) {
+	unsigned seen;
+
+	seen = (uintptr_t) arg;
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (gen == seen)
+			pthread_cond_wait(&start, &lock);
+		seen = gen;
+		pthread_mutex_unlock(&lock);
+		run_items();
+		pthread_mutex_lock(&lock);
+		if (++n_done == n_threads)
+			pthread_cond_signal(&done);
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+void pool_init(int n) {
+	int ret;
+
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > MAX_THREADS)
+		n = MAX_THREADS;
+	while (n_threads < n - 1) {
+		ret = pthread_create(&threads[n_threads], NULL, worker,
+				(void *) (uintptr_t) gen);
+		if (ret)
+			die("pthread_create: %s\n", strerror(ret));
+		n_threads++;
+	}
+}
+
+void pool_run(void (*fn)(void *, int), void *arg, int n) {
+	int i;
+
+	if (n_threads == 0 || n <= 1) {
+		for (i = 0; i < n; i++)
+			fn(arg, i);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	job_fn = fn;
+	job_arg = arg;
+	job_n = n;
+	next = 0;
+	n_done = 0;
+	gen++;
+	pthread_cond_broadcast(&start);
+	pthread_mutex_unlock(&lock);
+	run_items();
+	pthread_mutex_lock(&lock);
+	while (n_done < n_threads)
+		pthread_cond_wait(&done, &lock);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,7 @@
+#ifndef POOL_H
+#define POOL_H
+
+void pool_init(int n);
+void pool_run(void (*fn)(void *, int), void *arg, int n);
+
+#endif
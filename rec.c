@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+#include "aio.h"
+#include "draw.h"
+#include "pool.h"
+#include "rec.h"
+#include "sim.h"
+
+#define N_FIELDS 5
+#define MAX_PATH 4096
+#define SEG_SECONDS 4
+
+struct output {
+	struct rendition r;
+	struct SwsContext *sws;
+	AVFormatContext *fmtctx;
+	AVStream *vid;
+	AVCodecContext *cctx;
+	AVPacket *pkt;
+	AVFrame *frame;
+	int seg;
+	int64_t seg_pts;
+	int64_t end_pts;
+	int64_t key_pts;
+	float *durs;
+	int cap_durs;
+};
+
+static struct output outs[MAX_RENDITIONS];
+static int n_outs;
+static int height;
+static const uint8_t *cur_src;
+static int cur_stride;
+static int64_t cur_pts;
+
+void parse_rendition(struct rendition *r, char *spec) {
+	char *f[N_FIELDS];
+	size_t len;
+	int i;
+
+	f[0] = spec;
+	for (i = 1; i < N_FIELDS; i++) {
+		f[i] = f[i - 1] ? strchr(f[i - 1], ':') : NULL;
+		if (f[i])
+			*f[i]++ = '\0';
+		else if (i < N_FIELDS - 1)
+			die("rendition: expected "
+				"WxH:bitrate:codec:path[:window]\n");
+	}
+	if (sscanf(f[0], "%dx%d", &r->width, &r->height) != 2 ||
+			r->width <= 0 || r->height <= 0)
+		die("rendition: bad size: %s\n", f[0]);
+	r->bit_rate = strtoll(f[1], NULL, 10);
+	if (r->bit_rate <= 0)
+		die("rendition: bad bitrate: %s\n", f[1]);
+	r->codec = *f[2] && strcmp(f[2], "-") ? f[2] : NULL;
+	r->path = f[3];
+	len = strlen(r->path);
+	r->hls = len > 5 && !strcmp(r->path + len - 5, ".m3u8");
+	r->window = f[4] ? atoi(f[4]) : 0;
+	if (f[4] && (!r->hls || r->window <= 0))
+		die("rendition: window needs an .m3u8 path\n");
+}
+
+static void seg_path(char *dst, const struct output *o, int seg) {
+	int n;
+
+	n = snprintf(dst, MAX_PATH, "%.*s%05d.ts",
+			(int) strlen(o->r.path) - 5, o->r.path, seg);
+	if (n >= MAX_PATH)
+		die("rendition: path too long\n");
+}
+
+static void open_muxer(struct output *o, const char *path,
+		const AVOutputFormat *outfmt) {
+	int ret;
+
+	ret = avformat_alloc_output_context2(&o->fmtctx, outfmt, NULL, path);
+	if (ret < 0)
+		die("avformat_alloc_output_context2: %s\n",
+				av_err2str(ret));
+	o->vid = avformat_new_stream(o->fmtctx, NULL);
+	if (!o->vid)
+		die("avformat_new_stream\n");
+	avcodec_parameters_from_context(o->vid->codecpar, o->cctx);
+	o->vid->time_base = o->cctx->time_base;
+	o->fmtctx->pb = aio_open(path);
+	ret = avformat_write_header(o->fmtctx, NULL);
+	if (ret < 0)
+		die("avformat_write_header: %s\n", av_err2str(ret));
+}
+
+static void close_muxer(struct output *o) {
+	av_write_trailer(o->fmtctx);
+	aio_close(&o->fmtctx->pb);
+	avformat_free_context(o->fmtctx);
+	o->fmtctx = NULL;
+}
+
+static void write_playlist(struct output *o, int done) {
+	char path[MAX_PATH], seg[MAX_PATH];
+	const char *name;
+	FILE *f;
+	int i, first;
+
+	snprintf(path, MAX_PATH, "%s.tmp", o->r.path);
+	f = fopen(path, "w");
+	if (!f)
+		die("fopen: %s\n", path);
+	first = o->r.window && o->seg > o->r.window ?
+		o->seg - o->r.window : 0;
+	fprintf(f, "#EXTM3U\n#EXT-X-VERSION:3\n");
+	fprintf(f, "#EXT-X-TARGETDURATION:%d\n", SEG_SECONDS);
+	fprintf(f, "#EXT-X-MEDIA-SEQUENCE:%d\n", first);
+	if (!o->r.window)
+		fprintf(f, "#EXT-X-PLAYLIST-TYPE:%s\n",
+				done ? "VOD" : "EVENT");
+	for (i = first; i < o->seg; i++) {
+		seg_path(seg, o, i);
+		name = strrchr(seg, '/');
+		fprintf(f, "#EXTINF:%.3f,\n%s\n", o->durs[i],
+				name ? name + 1 : seg);
+	}
+	if (done)
+		fprintf(f, "#EXT-X-ENDLIST\n");
+	if (fclose(f))
+		die("fclose: %s\n", path);
+	if (rename(path, o->r.path))
+		die("rename: %s\n", o->r.path);
+}
+
+static void end_segment(struct output *o, int64_t pts) {
+	char path[MAX_PATH];
+	float dur;
+
+	close_muxer(o);
+	if (o->seg == o->cap_durs) {
+		o->cap_durs = o->cap_durs ? o->cap_durs * 2 : 64;
+		o->durs = realloc(o->durs, o->cap_durs * sizeof(*o->durs));
+		if (!o->durs)
+			die("realloc: out of memory\n");
+	}
+	dur = (pts - o->seg_pts) / (float) FPS;
+	o->durs[o->seg++] = dur;
+	o->seg_pts = pts;
+	if (o->r.window && o->seg > 2 * o->r.window) {
+		seg_path(path, o, o->seg - 2 * o->r.window - 1);
+		remove(path);
+	}
+}
+
+static void next_segment(struct output *o, int64_t pts) {
+	char path[MAX_PATH];
+
+	end_segment(o, pts);
+	write_playlist(o, 0);
+	seg_path(path, o, o->seg);
+	open_muxer(o, path, av_guess_format("mpegts", NULL, NULL));
+}
+
+static void open_output(struct output *o, int src_w, int src_h) {
+	const AVOutputFormat *outfmt;
+	const AVCodec *codec;
+	char path[MAX_PATH];
+	int ret;
+
+	o->sws = sws_getContext(src_w, src_h, AV_PIX_FMT_RGB24,
+		o->r.width, o->r.height, AV_PIX_FMT_YUV420P, SWS_BILINEAR,
+		NULL, NULL, NULL);
+	if (!o->sws)
+		die("sws_getContext\n");
+	outfmt = o->r.hls ? av_guess_format("mpegts", NULL, NULL) :
+		av_guess_format(NULL, o->r.path, NULL);
+	if (!outfmt)
+		die("av_guess_format\n");
+	if (o->r.codec)
+		codec = avcodec_find_encoder_by_name(o->r.codec);
+	else if (o->r.hls)
+		codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+	else
+		codec = avcodec_find_encoder(outfmt->video_codec);
+	if (!codec)
+		die("avcodec_find_encoder\n");
+	o->cctx = avcodec_alloc_context3(codec);
+	if (!o->cctx)
+		die("avcodec_alloc_context3\n");
+	av_opt_set(o->cctx, "preset", "ultrafast", 0);
+	o->cctx->width = o->r.width;
+	o->cctx->height = o->r.height;
+	o->cctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	o->cctx->bit_rate = o->r.bit_rate;
+	o->cctx->time_base.num = 1;
+	o->cctx->time_base.den = FPS;
+	o->cctx->framerate.num = FPS;
+	o->cctx->framerate.den = 1;
+	o->cctx->gop_size = o->r.hls ? FPS * SEG_SECONDS : FPS * 10;
+	o->cctx->max_b_frames = 1;
+	ret = avcodec_open2(o->cctx, codec, NULL);
+	if (ret < 0)
+		die("avcodec_open2: %s\n", av_err2str(ret));
+	if (o->r.hls) {
+		seg_path(path, o, 0);
+		open_muxer(o, path, outfmt);
+	} else {
+		open_muxer(o, o->r.path, outfmt);
+	}
+	o->pkt = av_packet_alloc();
+	if (!o->pkt)
+		die("av_packet_alloc\n");
+	o->frame = av_frame_alloc();
+	if (!o->frame)
+		die("av_frame_alloc\n");
+	o->frame->format = AV_PIX_FMT_YUV420P;
+	o->frame->width = o->r.width;
+	o->frame->height = o->r.height;
+	ret = av_frame_get_buffer(o->frame, 0);
+	if (ret < 0)
+		die("av_frame_get_buffer: %s\n", av_err2str(ret));
+}
+
+static void write_packet(struct output *o, AVPacket *pkt) {
+	if (o->r.hls && (pkt->flags & AV_PKT_FLAG_KEY) &&
+			pkt->pts > o->seg_pts)
+		next_segment(o, pkt->pts);
+	if (pkt->pts + 1 > o->end_pts)
+		o->end_pts = pkt->pts + 1;
+	av_packet_rescale_ts(pkt, o->cctx->time_base, o->vid->time_base);
+	pkt->stream_index = o->vid->index;
+	av_write_frame(o->fmtctx, pkt);
+}
+
+static void encode(struct output *o, AVFrame *frame) {
+	int ret;
+
+	if (frame && o->r.hls && frame->pts >= o->key_pts + FPS * SEG_SECONDS) {
+		frame->pict_type = AV_PICTURE_TYPE_I;
+		o->key_pts = frame->pts;
+	} else if (frame) {
+		frame->pict_type = AV_PICTURE_TYPE_NONE;
+	}
+	ret = avcodec_send_frame(o->cctx, frame);
+	if (ret < 0)
+		die("avcodec_send_frame: %s\n", av_err2str(ret));
+	while (ret >= 0) {
+		ret = avcodec_receive_packet(o->cctx, o->pkt);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			return;
+		if (ret < 0)
+			die("avcodec_receive_packet: %s\n", av_err2str(ret));
+		write_packet(o, o->pkt);
+		av_packet_unref(o->pkt);
+	}
+}
+
+static void hold_to_key(struct output *o, int64_t pts) {
+	if (!o->r.hls || o->frame->pts == AV_NOPTS_VALUE)
+		return;
+	while (pts > o->key_pts + FPS * SEG_SECONDS) {
+		o->frame->pts = o->key_pts + FPS * SEG_SECONDS;
+		encode(o, o->frame);
+	}
+}
+
+static void scale_encode(void *arg, int i) {
+	struct output *o;
+	int ret;
+
+	o = &outs[i];
+	hold_to_key(o, cur_pts);
+	ret = av_frame_make_writable(o->frame);
+	if (ret < 0)
+		die("av_frame_make_writable: %s\n", av_err2str(ret));
+	sws_scale(o->sws, &cur_src, &cur_stride, 0, height,
+			o->frame->data, o->frame->linesize);
+	o->frame->pts = cur_pts;
+	encode(o, o->frame);
+}
+
+static void repeat(void *arg, int i) {
+	struct output *o;
+
+	o = &outs[i];
+	hold_to_key(o, cur_pts);
+	o->frame->pts = cur_pts;
+	encode(o, o->frame);
+}
+
+static void flush(void *arg, int i) {
+	struct output *o;
+
+	o = &outs[i];
+	hold_to_key(o, cur_pts - 1);
+	if (o->frame->pts != AV_NOPTS_VALUE &&
+			o->frame->pts < cur_pts - 1) {
+		o->frame->pts = cur_pts - 1;
+		encode(o, o->frame);
+	}
+	encode(o, NULL);
+}
+
+void rec_open(const struct rendition *r, int n, int src_w, int src_h) {
+	int i;
+
+	if (n > MAX_RENDITIONS)
+		die("rec_open: too many renditions\n");
+	height = src_h;
+	n_outs = n;
+	for (i = 0; i < n; i++) {
+		memset(&outs[i], 0, sizeof(outs[i]));
+		outs[i].r = r[i];
+		open_output(&outs[i], src_w, src_h);
+	}
+}
+
+void rec_frame(const uint8_t *src, int src_stride, int64_t pts) {
+	cur_src = src;
+	cur_stride = src_stride;
+	cur_pts = pts;
+	pool_run(scale_encode, NULL, n_outs);
+}
+
+void rec_repeat(int64_t pts) {
+	cur_pts = pts;
+	pool_run(repeat, NULL, n_outs);
+}
+
+void rec_close(int64_t end_pts) {
+	struct output *o;
+	int i;
+
+	cur_pts = end_pts;
+	pool_run(flush, NULL, n_outs);
+	for (i = 0; i < n_outs; i++) {
+		o = &outs[i];
+		if (o->r.hls) {
+			end_segment(o, o->end_pts);
+			write_playlist(o, 1);
+		} else {
+			close_muxer(o);
+		}
+		av_frame_free(&o->frame);
+		av_packet_free(&o->pkt);
+		avcodec_free_context(&o->cctx);
+		sws_freeContext(o->sws);
+		free(o->durs);
+	}
+	n_outs = 0;
+}
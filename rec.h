@@ -0,0 +1,24 @@
+#ifndef REC_H
+#define REC_H
+
+#include <stdint.h>
+
+#define MAX_RENDITIONS 8
+
+struct rendition {
+	int width;
+	int height;
+	int64_t bit_rate;
+	const char *codec;
+	const char *path;
+	int hls;
+	int window;
+};
+
+void parse_rendition(struct rendition *r, char *spec);
+void rec_open(const struct rendition *r, int n, int src_w, int src_h);
+void rec_frame(const uint8_t *src, int src_stride, int64_t pts);
+void rec_repeat(int64_t pts);
+void rec_close(int64_t end_pts);
+
+#endif
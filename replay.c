@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "contact.h"
+#include "draw.h"
+#include "replay.h"
+#include "table.h"
+
+static FILE *out, *in;
+static const char *out_path, *in_path;
+static struct replay_tick cur;
+static uint64_t hash, ticks, want;
+
+uint64_t world_hash(uint64_t h, const struct world *w) {
+	int i;
+
+	for (i = 0; i < N_BALLS; i++)
+		h = hash_bytes(h, &w->balls[w->slot[i]], sizeof(*w->balls));
+	return hash_bytes(h, w->flippers, sizeof(w->flippers));
+}
+
+static void put(const void *p, size_t size) {
+	if (fwrite(p, size, 1, out) != 1)
+		die("fwrite: %s: %s\n", out_path, strerror(errno));
+}
+
+static void get(void *p, size_t size) {
+	if (fread(p, size, 1, in) != 1)
+		die("replay: %s: truncated\n", in_path);
+}
+
+static uint8_t touch_bits(void) {
+	uint8_t t;
+	int i;
+
+	t = 0;
+	for (i = 0; i < N_FLIPPERS; i++) {
+		if (world.flippers[i].touch_id >= 0)
+			t |= 1U << i;
+	}
+	return t;
+}
+
+void replay_record(const char *path) {
+	struct replay_header h;
+
+	out = fopen(path, "wb");
+	if (!out)
+		die("fopen: %s: %s\n", path, strerror(errno));
+	out_path = path;
+	memset(&h, 0, sizeof(h));
+	h.magic = REPLAY_MAGIC;
+	h.version = REPLAY_VERSION;
+	h.table_hash = table_hash(&table);
+	h.endian = REPLAY_ENDIAN;
+	h.world_size = sizeof(world);
+	h.n_balls = N_BALLS;
+	h.n_flippers = N_FLIPPERS;
+	h.hash_interval = HASH_INTERVAL;
+	h.fixed_mode = fixed_mode;
+	h.max_substeps = max_substeps;
+	h.solver_iterations = solver_iterations;
+	h.warm_start = warm_start;
+	h.sort_interval = sort_interval;
+	put(&h, sizeof(h));
+	put(&world, sizeof(world));
+	hash = world_hash(0xCBF29CE484222325ULL, &world);
+	ticks = 0;
+}
+
+void replay_push(void) {
+	struct replay_tick t;
+
+	ticks++;
+	hash = world_hash(hash, &world);
+	t.touch = touch_bits();
+	t.pad = 0;
+	t.tag = hash;
+	put(&t, sizeof(t));
+	if (ticks % HASH_INTERVAL == 0)
+		put(&hash, sizeof(hash));
+}
+
+void replay_load(void) {
+	struct replay_tick t;
+
+	t.touch = REPLAY_LOAD;
+	t.pad = 0;
+	t.tag = 0;
+	put(&t, sizeof(t));
+	put(&world, sizeof(world));
+	hash = world_hash(hash, &world);
+}
+
+void replay_close(void) {
+	if (fclose(out))
+		die("fclose: %s: %s\n", out_path, strerror(errno));
+	out = NULL;
+}
+
+void replay_open(const char *path) {
+	struct replay_header h;
+	struct world w;
+
+	if (in)
+		fclose(in);
+	in = fopen(path, "rb");
+	if (!in)
+		die("fopen: %s: %s\n", path, strerror(errno));
+	in_path = path;
+	get(&h, sizeof(h));
+	if (h.magic != REPLAY_MAGIC || h.version != REPLAY_VERSION ||
+			h.endian != REPLAY_ENDIAN ||
+			h.world_size != sizeof(world) ||
+			h.n_balls != N_BALLS || h.n_flippers != N_FLIPPERS ||
+			h.hash_interval != HASH_INTERVAL)
+		die("replay: %s: layout mismatch\n", path);
+	if (h.table_hash != table_hash(&table))
+		die("replay: %s: recorded on another table\n", path);
+	fixed_mode = h.fixed_mode;
+	max_substeps = h.max_substeps;
+	solver_iterations = h.solver_iterations;
+	warm_start = h.warm_start;
+	sort_interval = h.sort_interval;
+	get(&w, sizeof(w));
+	load_state(&w);
+	hash = world_hash(0xCBF29CE484222325ULL, &world);
+	ticks = 0;
+}
+
+int replay_next(void) {
+	struct world w;
+	int i;
+
+	while (fread(&cur, sizeof(cur), 1, in) == 1) {
+		if (cur.touch & REPLAY_LOAD) {
+			get(&w, sizeof(w));
+			load_state(&w);
+			hash = world_hash(hash, &world);
+			continue;
+		}
+		for (i = 0; i < N_FLIPPERS; i++)
+			world.flippers[i].touch_id = cur.touch >> i & 1 ? 0.0F : -1.0F;
+		ticks++;
+		if (ticks % HASH_INTERVAL == 0)
+			get(&want, sizeof(want));
+		return 1;
+	}
+	if (ferror(in))
+		die("fread: %s: %s\n", in_path, strerror(errno));
+	return 0;
+}
+
+void replay_mark(struct replay_mark *m) {
+	m->off = ftell(in);
+	m->ticks = ticks;
+	m->hash = hash;
+}
+
+void replay_resume(const struct replay_mark *m) {
+	if (fseek(in, m->off, SEEK_SET))
+		die("fseek: %s: %s\n", in_path, strerror(errno));
+	ticks = m->ticks;
+	hash = m->hash;
+}
+
+static int diverged(const char *path, uint64_t t) {
+	printf("%s: diverges at tick %llu\n", path, (unsigned long long) t);
+	return 1;
+}
+
+int replay_verify(const char *path) {
+	uint64_t first;
+
+	replay_open(path);
+	first = 0;
+	while (replay_next()) {
+		simulate();
+		hash = world_hash(hash, &world);
+		if (!first && (uint16_t) hash != cur.tag)
+			first = ticks;
+		if (ticks % HASH_INTERVAL)
+			continue;
+		if (want != hash)
+			return diverged(path, first ? first : ticks);
+		first = 0;
+	}
+	if (first)
+		return diverged(path, first);
+	printf("%s: %llu ticks match\n", path, (unsigned long long) ticks);
+	return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define REPLAY_MAGIC 0x504C5052
+#define REPLAY_VERSION 1
+#define REPLAY_ENDIAN 0x01020304
+#define HASH_INTERVAL 64
+#define REPLAY_LOAD 0x80
+
+struct replay_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t table_hash;
+	uint32_t endian;
+	uint32_t world_size;
+	uint16_t n_balls;
+	uint16_t n_flippers;
+	uint32_t hash_interval;
+	int32_t fixed_mode;
+	int32_t max_substeps;
+	int32_t solver_iterations;
+	int32_t warm_start;
+	int32_t sort_interval;
+};
+
+struct replay_tick {
+	uint8_t touch;
+	uint8_t pad;
+	uint16_t tag;
+};
+
+struct replay_mark {
+	long off;
+	uint64_t ticks;
+	uint64_t hash;
+};
+
+uint64_t world_hash(uint64_t h, const struct world *w);
+void replay_record(const char *path);
+void replay_push(void);
+void replay_load(void);
+void replay_close(void);
+void replay_open(const char *path);
+int replay_next(void);
+void replay_mark(struct replay_mark *m);
+void replay_resume(const struct replay_mark *m);
+int replay_verify(const char *path);
+
+#endif
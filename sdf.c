@@ -0,0 +1,153 @@
+#include <math.h>
+#include <stdlib.h>
+#include "bvh.h"
+#include "draw.h"
+#include "kern.h"
+#include "sdf.h"
+
+#define MAX_CELLS (1 << 24)
+#define PAD_CELLS 2
+
+struct cell {
+	float wall;
+	float obst;
+};
+
+static struct cell *grid;
+static int grid_w;
+static int grid_h;
+static struct vec2 origin;
+static float inv_step;
+static float margin;
+static int cross_check;
+static const struct kernel *exact;
+
+static void grow_bounds(struct vec2 *lo, struct vec2 *hi, struct vec2 p,
+		float r) {
+	lo->x = fminf(lo->x, p.x - r);
+	lo->y = fminf(lo->y, p.y - r);
+	hi->x = fmaxf(hi->x, p.x + r);
+	hi->y = fmaxf(hi->y, p.y + r);
+}
+
+static float obstacle_distance(struct vec2 p) {
+	const struct obstacle *o;
+	struct vec2 d;
+	float dist;
+	int i;
+
+	dist = INFINITY;
+	for (i = 0; i < table.n_obstacles; i++) {
+		o = &table.obstacles[i];
+		d = vec2_sub(p, o->pos);
+		dist = fminf(dist, sqrtf(dot(d, d)) - o->radius);
+	}
+	return dist;
+}
+
+static int sample(struct vec2 p, struct cell *c) {
+	const struct cell *c0, *c1;
+	float fx, fy, tx, ty;
+	int x, y;
+
+	fx = (p.x - origin.x) * inv_step;
+	fy = (p.y - origin.y) * inv_step;
+	if (!(fx >= 0.0F && fy >= 0.0F &&
+			fx < grid_w - 1 && fy < grid_h - 1))
+		return 0;
+	x = fx;
+	y = fy;
+	tx = fx - x;
+	ty = fy - y;
+	c0 = &grid[y * grid_w + x];
+	c1 = c0 + grid_w;
+	c->wall = (c0[0].wall * (1.0F - tx) + c0[1].wall * tx) * (1.0F - ty) +
+		(c1[0].wall * (1.0F - tx) + c1[1].wall * tx) * ty;
+	c->obst = (c0[0].obst * (1.0F - tx) + c0[1].obst * tx) * (1.0F - ty) +
+		(c1[0].obst * (1.0F - tx) + c1[1].obst * tx) * ty;
+	return 1;
+}
+
+static void check_culled(const struct ball *b, int n, const char *what) {
+	if (contact_count() != n)
+		die("sdf: culled %s contact at (%g, %g)\n", what,
+				b->pos.x, b->pos.y);
+}
+
+static void sdf_obstacles(const struct ball *b, int i) {
+	struct cell c;
+	int n;
+
+	if (sample(b->pos, &c) && c.obst - margin > b->radius) {
+		if (cross_check) {
+			n = contact_count();
+			exact->obstacles(b, i);
+			check_culled(b, n, "obstacle");
+		}
+		return;
+	}
+	exact->obstacles(b, i);
+}
+
+static void sdf_border(const struct ball *b, int i, float dt) {
+	struct cell c;
+	int n;
+
+	if (sample(b->pos, &c) && c.wall - margin > ball_reach(b, dt)) {
+		if (cross_check) {
+			n = contact_count();
+			exact->border(b, i, dt);
+			check_culled(b, n, "wall");
+		}
+		return;
+	}
+	exact->border(b, i, dt);
+}
+
+static const struct kernel sdf_kernel = {
+	0,
+	sdf_obstacles,
+	sdf_border
+};
+
+void sdf_init(float res, int check) {
+	struct vec2 lo, hi, p;
+	struct cell *c;
+	float step;
+	int i, x, y;
+
+	if (!(res > 0.0F))
+		die("sdf: bad resolution\n");
+	lo.x = lo.y = INFINITY;
+	hi.x = hi.y = -INFINITY;
+	for (i = 0; i < table.n_border; i++)
+		grow_bounds(&lo, &hi, table.border[i], 0.0F);
+	for (i = 0; i < table.n_obstacles; i++)
+		grow_bounds(&lo, &hi, table.obstacles[i].pos,
+				table.obstacles[i].radius);
+	step = 1.0F / res;
+	origin.x = lo.x - PAD_CELLS * step;
+	origin.y = lo.y - PAD_CELLS * step;
+	grid_w = ceilf((hi.x - lo.x) * res) + 2 * PAD_CELLS + 1;
+	grid_h = ceilf((hi.y - lo.y) * res) + 2 * PAD_CELLS + 1;
+	if ((long) grid_w * grid_h > MAX_CELLS)
+		die("sdf: grid too large\n");
+	free(grid);
+	grid = malloc((size_t) grid_w * grid_h * sizeof(*grid));
+	if (!grid)
+		die("malloc: out of memory\n");
+	for (y = 0; y < grid_h; y++) {
+		for (x = 0; x < grid_w; x++) {
+			c = &grid[y * grid_w + x];
+			p.x = origin.x + x * step;
+			p.y = origin.y + y * step;
+			c->wall = bvh_distance(p);
+			c->obst = obstacle_distance(p);
+		}
+	}
+	inv_step = res;
+	margin = step * (float) M_SQRT2;
+	cross_check = check;
+	exact = table.kernel ? table.kernel : &generic_kernel;
+	table.kernel = &sdf_kernel;
+}
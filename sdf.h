@@ -0,0 +1,12 @@
+#ifndef SDF_H
+#define SDF_H
+
+/*
+ * Bakes an unsigned wall distance and a bumper distance, without gradients,
+ * and wraps the kernel to skip exact tests for balls clear of both. The
+ * grid only culls; contacts always come from the exact kernel, and check
+ * (-x) re-runs it on every culled test to catch a wrong skip.
+ */
+void sdf_init(float res, int check);
+
+#endif
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "draw.h"
+#include "shm.h"
+
+#define SHM_MAGIC 0x50425348
+
+struct shm_ring *shm_create(const char *name) {
+	struct shm_ring *r;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die("shm_open: %s: %s\n", name, strerror(errno));
+	if (ftruncate(fd, sizeof(*r)) < 0)
+		die("ftruncate: %s\n", strerror(errno));
+	r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED)
+		die("mmap: %s\n", strerror(errno));
+	close(fd);
+	r->n_balls = N_BALLS;
+	r->n_flippers = N_FLIPPERS;
+	r->n_slots = SHM_SLOTS;
+	__atomic_store_n(&r->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	return r;
+}
+
+struct shm_ring *shm_attach(const char *name) {
+	struct shm_ring *r;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		die("shm_open: %s: %s\n", name, strerror(errno));
+	if (fstat(fd, &st) < 0)
+		die("fstat: %s\n", strerror(errno));
+	if (st.st_size != sizeof(*r))
+		die("shm_attach: %s: size mismatch\n", name);
+	r = mmap(NULL, sizeof(*r), PROT_READ, MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED)
+		die("mmap: %s\n", strerror(errno));
+	close(fd);
+	if (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+			r->n_balls != N_BALLS ||
+			r->n_flippers != N_FLIPPERS ||
+			r->n_slots != SHM_SLOTS)
+		die("shm_attach: %s: layout mismatch\n", name);
+	return r;
+}
+
+void shm_destroy(struct shm_ring *r, const char *name) {
+	munmap(r, sizeof(*r));
+	shm_unlink(name);
+}
+
+void shm_publish(struct shm_ring *r, uint64_t tick) {
+	struct shm_slot *slot;
+	struct shm_state *s;
+	int i;
+
+	slot = &r->slots[tick % SHM_SLOTS];
+	s = &slot->state;
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->tick = tick;
+	for (i = 0; i < N_BALLS; i++) {
+		s->pos[i] = world.balls[world.slot[i]].pos;
+		s->vel[i] = world.balls[world.slot[i]].vel;
+	}
+	for (i = 0; i < N_FLIPPERS; i++)
+		s->rot[i] = world.flippers[i].rot;
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->head, tick + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t shm_head(const struct shm_ring *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+int shm_read(const struct shm_ring *r, uint64_t tick, struct shm_state *s) {
+	const struct shm_slot *slot;
+	uint32_t seq;
+
+	slot = &r->slots[tick % SHM_SLOTS];
+	for (;;) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(s, &slot->state, sizeof(*s));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	return s->tick == tick && seq != 0 ? 0 : -1;
+}
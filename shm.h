@@ -0,0 +1,37 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define SHM_SLOTS 64
+
+struct shm_state {
+	uint64_t tick;
+	struct vec2 pos[N_BALLS];
+	struct vec2 vel[N_BALLS];
+	float rot[N_FLIPPERS];
+};
+
+struct shm_slot {
+	uint32_t seq;
+	struct shm_state state;
+};
+
+struct shm_ring {
+	uint32_t magic;
+	uint32_t n_balls;
+	uint32_t n_flippers;
+	uint32_t n_slots;
+	uint64_t head;
+	struct shm_slot slots[SHM_SLOTS];
+};
+
+struct shm_ring *shm_create(const char *name);
+struct shm_ring *shm_attach(const char *name);
+void shm_destroy(struct shm_ring *r, const char *name);
+void shm_publish(struct shm_ring *r, uint64_t tick);
+uint64_t shm_head(const struct shm_ring *r);
+int shm_read(const struct shm_ring *r, uint64_t tick, struct shm_state *s);
+
+#endif
@@ -1,14 +1,59 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include "bvh.h"
+#include "draw.h"
+#include "fix.h"
+#include "kern.h"
+#include "pool.h"
 #include "sim.h"
+#include "table.h"
 
-struct ball balls[N_BALLS] = {
-	{0.03F, M_PI * 0.03F * 0.03F, {0.92F, 0.5F}, {-0.2F, 3.5F}, 0.2F},
-	{0.03F, M_PI * 0.03F * 0.03F, {0.08F, 0.5F}, {0.2F, 3.5F}, 0.2F},
+#define MAX_SWEEPS 4
+#define MAX_ADVANCE 32
+#define CONTACT_EPS 1e-3F
+#define SUBSTEP_TRAVEL 0.5F
+#define MOVE_CHUNK 256
+#define SLEEP_VEL 0.05F
+#define SLEEP_TIME 0.5F
+#define SORT_DISORDER 0.25F
+#define MORTON_MAX 65535.0F
+#define SORT_BLOCK_BITS 6
+#define CELL_SCALE 0.49F
+
+struct flipper_geom {
+	struct vec2 pos;
+	struct vec2 ab;
+	float a_ab;
+	float inv_ab2;
+	float radius;
+	float wvel;
+	float bound;
 };
 
-struct vec2 border[N_BORDER] = {
+struct world world = {
+	{
+		{0.03F, M_PI * 0.03F * 0.03F, {0.92F, 0.5F}, 
+		 {-0.2F, 3.5F}, 0.2F, 0.0F, 0},
+		{0.03F, M_PI * 0.03F * 0.03F, {0.08F, 0.5F}, 
+		 {0.2F, 3.5F}, 0.2F, 0.0F, 0},
+	},
+	{
+		{0.03F, {0.26F, 0.22F}, 0.2F, -0.5F, 
+		 1.0F, 1.0F, 10.0F, 0.0F, 0.0F, -1.0F},
+		{0.03F, {0.74F, 0.22F}, 0.2F, M_PI + 0.5F, 
+		 1.0F, -1.0F, 10.0F, 0.0F, 0.0F, -1.0F}
+	},
+	{0, 1},
+	0,
+	0,
+	{{0, 0, 0, 0.0F}},
+	0,
+	{0, 1}
+};
+
+static const struct vec2 border[] = {
 	{0.74F, 0.25F},
 	{0.98F, 0.4F},
 	{0.98F, 1.68F},
@@ -19,76 +64,83 @@ struct vec2 border[N_BORDER] = {
 	{0.74F, 0.02f}
 };
 
-struct obstacle obstacles[N_OBSTACLES] = {
+static const struct polyline lines[] = {
+	{0, sizeof(border) / sizeof(*border), 1}
+};
+
+static const struct obstacle obstacles[] = {
 	{0.1F, {0.25F, 0.6F}, 2.0F},
 	{0.1F, {0.75F, 0.5F}, 2.0F},
 	{0.12F, {0.7F, 1.0F}, 2.0F},
 	{0.1F, {0.2F, 1.2F}, 2.0F},
 };
 
-struct flipper flippers[N_FLIPPERS] = {
-	{0.03F, {0.26F, 0.22F}, 0.2F, -0.5F, 
-	 1.0F, 1.0F, 10.0F, 0.0F, 0.0F, -1.0F},
-	{0.03F, {0.74F, 0.22F}, 0.2F, M_PI + 0.5F, 
-	 1.0F, -1.0F, 10.0F, 0.0F, 0.0F, -1.0F}
+struct table table = {
+	sizeof(border) / sizeof(*border),
+	sizeof(lines) / sizeof(*lines),
+	sizeof(obstacles) / sizeof(*obstacles),
+	border,
+	lines,
+	obstacles,
+	NULL
 };
 
-static struct vec2 gravity = {0.0F, -3.0F};
+int max_substeps = 8;
+int sort_interval;
+int fixed_mode;
 
-static void ball_ball(struct ball *a, struct ball *b) {
-	float dx, dy, dv;
-	float corr;
-	float ma, mb;
-	float v0a, v1a, v0b, v1b;
-	float rest;
+const struct vec2 gravity = {0.0F, -3.0F};
 
-	rest = fminf(a->restitution, b->restitution);
-	dx = b->pos.x - a->pos.x;
-	dy = b->pos.y - a->pos.y;
-	dv = sqrtf(dx * dx + dy * dy);
-	if (dv == 0.0F || dv > a->radius + b->radius)
-		return;
-	dx /= dv;
-	dy /= dv;
-	corr = (a->radius + b->radius - dv) / 2.0F;
-	a->pos.x -= dx * corr;
-	a->pos.y -= dy * corr;
-	b->pos.x += dx * corr;
-	b->pos.y += dy * corr;
-	v0a = a->vel.x * dx + a->vel.y * dy;
-	v0b = b->vel.x * dx + b->vel.y * dy;
-	ma = a->mass;
-	mb = b->mass;
-	v1a = (ma * v0a + mb * v0b - mb * (v0a - v0b) * rest) / (ma + mb);
-	v1b = (ma * v0a + mb * v0b - ma * (v0b - v0a) * rest) / (ma + mb);
-	a->vel.x += dx * (v1a - v0a);
-	a->vel.y += dy * (v1a - v0a);
-	b->vel.x += dx * (v1b - v0b);
-	b->vel.y += dy * (v1b - v0b);
-}
-
-static struct vec2 perp(struct vec2 a) {
-	struct vec2 res;
+static struct flipper_geom geom[N_FLIPPERS];
+static int island[N_BALLS];
+static float island_idle[N_BALLS];
+static struct vec2 step_start[N_BALLS];
+static struct vec2 sort_lo;
+static uint32_t codes[N_BALLS];
+static uint32_t cell_x[N_BALLS];
+static uint32_t cell_y[N_BALLS];
+static uint64_t *pairs;
+static int n_pairs, pair_cap;
+static int order[N_BALLS];
+static int index_of[N_BALLS];
+static struct ball sorted[N_BALLS];
+static int sorted_ring[N_BALLS];
 
-	res.x = -a.y;
-	res.y = a.x;
-	return res; 
-}
-
-static float dot(struct vec2 a, struct vec2 b) {
-	return a.x * b.x + a.y * b.y;
-}
+static void wake(int i) {
+	struct ball *b;
+	int j;
 
-static float clamp(float v, float l, float h) {
-	return fmaxf(fminf(v, h), l);
+	if (!world.balls[i].sleep)
+		return;
+	j = i;
+	do {
+		b = &world.balls[j];
+		b->sleep = 0;
+		b->idle = 0.0F;
+		j = world.ring[j];
+	} while (j != i);
 }
 
-static struct vec2 vec2_sub(struct vec2 a, struct vec2 b) { 
-	struct vec2 res;
+static void ball_ball(int i, int j) {
+	struct ball *a, *b;
+	struct vec2 n;
+	float d, rest;
 
-	res.x = a.x - b.x;
-	res.y = a.y - b.y;
-	return res;
+	a = &world.balls[i];
+	b = &world.balls[j];
+	if (a->sleep && b->sleep)
+		return;
+	n = vec2_sub(a->pos, b->pos);
+	d = sqrtf(dot(n, n));
+	if (d == 0.0F || d > a->radius + b->radius)
+		return;
+	wake(i);
+	wake(j);
+	n.x /= d;
+	n.y /= d;
+	rest = fminf(a->restitution, b->restitution);
+	contact_add(i, j, FEATURE(FEATURE_BALL, 0), n, a->radius + b->radius - d,
+			-rest * dot(vec2_sub(a->vel, b->vel), n));
 }
 
 static struct vec2 closest_pos(struct vec2 p, struct vec2 a, struct vec2 b) {
@@ -105,120 +157,475 @@ static struct vec2 closest_pos(struct vec2 p, struct vec2 a, struct vec2 b) {
 	return res;
 }
 
-static void ball_border(struct ball *ball) {
-	struct vec2 a, b, c, d, min_disp;
-	struct vec2 ab, n;
-	float scale, dist, min_dist;
-	float v0, v1;
+static void ball_obstacles(const struct ball *a, int i) {
+	const struct obstacle *o;
+	int j;
+
+	for (j = 0; j < table.n_obstacles; j++) {
+		o = &table.obstacles[j];
+		obstacle_hit(a, i, j, o->radius, o->pos.x, o->pos.y,
+				o->push_vel);
+	}
+}
+
+static void sweep_obstacles(struct sweep_hit *h, const struct ball *b,
+		struct vec2 d) {
+	const struct obstacle *o;
 	int i;
 
-	for (i = 0; i < N_BORDER; i++) {
-		a = border[i];
-		b = border[(i + 1) % N_BORDER];
-		c = closest_pos(ball->pos, a, b);
-		d = vec2_sub(ball->pos, c);
-		dist = dot(d, d); 
-		if (i == 0 || dist < min_dist) {
-			min_dist = dist;
-			min_disp = d;
-			ab = vec2_sub(b, a);
-			n = perp(ab);
-		}
+	for (i = 0; i < table.n_obstacles; i++) {
+		o = &table.obstacles[i];
+		sweep_point(h, b->pos, d, o->pos, b->radius + o->radius, 0,
+				o->push_vel);
 	}
-	d = min_dist == 0.0F ? n : min_disp;
-	dist = sqrtf(dot(d, d));
-	d.x /= dist;
-	d.y /= dist;
-	if (dot(d, n) < 0.0F) 
-		scale = -ball->radius - dist;
-	else if (dist > ball->radius) 
-		return;
-	else 
-		scale = ball->radius - dist;
-	ball->pos.x += d.x * scale;
-	ball->pos.y += d.y * scale;
-	v0 = dot(ball->vel, d);
-	v1 = fabsf(v0) * ball->restitution;
-	ball->vel.x += d.x * (v1 - v0);
-	ball->vel.y += d.y * (v1 - v0);
-}
-
-static void ball_obstacle(struct ball *a, struct obstacle *b) {
-	struct vec2 v;
-	float s, corr;
-
-	v = vec2_sub(a->pos, b->pos);
-	s = sqrtf(dot(v, v));
-	if (s == 0.0F || s > a->radius + b->radius)
+}
+
+static void advance(struct ball *b, float dt) {
+	struct sweep_hit h;
+	struct vec2 d;
+	float left, v0, v1;
+	int i;
+
+	d.x = b->vel.x * dt;
+	d.y = b->vel.y * dt;
+	if (dot(d, d) <= b->radius * b->radius) {
+		b->pos.x += d.x;
+		b->pos.y += d.y;
 		return;
-	v.x /= s;
-	v.y /= s;
-	corr = a->radius + b->radius - s;
-	a->pos.x += v.x * corr;
-	a->pos.y += v.y * corr;
-	corr = b->push_vel - dot(a->vel, v);
-	a->vel.x += v.x * corr;
-	a->vel.y += v.y * corr;
-}
-
-static struct vec2 get_tip(struct flipper *a) {
-	float rot;
+	}
+	left = 1.0F;
+	for (i = 0; i < MAX_SWEEPS; i++) {
+		d.x = b->vel.x * dt * left;
+		d.y = b->vel.y * dt * left;
+		h.t = 1.0F;
+		h.wall = -1;
+		bvh_sweep(&h, b->pos, d, b->radius);
+		sweep_obstacles(&h, b, d);
+		b->pos.x += d.x * h.t;
+		b->pos.y += d.y * h.t;
+		if (h.wall < 0)
+			return;
+		v0 = dot(b->vel, h.n);
+		v1 = h.wall ? fabsf(v0) * b->restitution : h.push_vel;
+		b->vel.x += h.n.x * (v1 - v0);
+		b->vel.y += h.n.y * (v1 - v0);
+		left *= 1.0F - h.t;
+	}
+}
+
+static struct vec2 tip_at(const struct flipper *a, float rot) {
 	struct vec2 tip;
 
-	rot = -(a->rest_rad + a->sign * a->rot);
 	tip.x = a->pos.x + cosf(rot) * a->length;
 	tip.y = a->pos.y + sinf(rot) * a->length; 
 	return tip;
 }
 
-static void ball_flipper(struct ball *a, struct flipper *b) {
+static void update_geom(struct flipper_geom *g, const struct flipper *f) {
+	g->pos = f->pos;
+	g->ab = vec2_sub(tip_at(f, -(f->rest_rad + f->sign * f->rot)), f->pos);
+	g->a_ab = dot(g->pos, g->ab);
+	g->inv_ab2 = 1.0F / dot(g->ab, g->ab);
+	g->radius = f->radius;
+	g->wvel = f->cur_wvel;
+	g->bound = f->length + f->radius;
+}
+
+static float surface_vel(const struct flipper_geom *g, struct vec2 pos,
+		struct vec2 dir) {
+	pos.x = (pos.x + dir.x * g->radius - g->pos.x) * g->wvel;
+	pos.y = (pos.y + dir.y * g->radius - g->pos.y) * g->wvel; 
+	return dot(perp(pos), dir);
+}
+
+static void sweep_flipper(struct ball *a, const struct flipper *b,
+		const struct flipper_geom *g, struct vec2 start, float dt) {
+	struct vec2 d, p, c, dir;
+	float rot, drot, bound, dist, s, t;
+	int i;
+
+	d = vec2_sub(a->pos, start);
+	drot = g->wvel * dt;
+	bound = sqrtf(dot(d, d)) + fabsf(drot) * b->length;
+	if (bound <= a->radius)
+		return;
+	c = vec2_sub(closest_pos(g->pos, start, a->pos), g->pos);
+	if (dot(c, c) > (g->bound + a->radius) * (g->bound + a->radius))
+		return;
+	rot = -(b->rest_rad + b->sign * b->rot);
+	t = 0.0F;
+	for (i = 0; i < MAX_ADVANCE; i++) {
+		p.x = start.x + d.x * t;
+		p.y = start.y + d.y * t;
+		c = closest_pos(p, b->pos, tip_at(b, rot - (1.0F - t) * drot));
+		dir = vec2_sub(p, c);
+		dist = sqrtf(dot(dir, dir)) - a->radius - b->radius;
+		if (dist <= CONTACT_EPS)
+			break;
+		t += dist / bound;
+		if (t >= 1.0F)
+			return;
+	}
+	if (i == MAX_ADVANCE)
+		return;
+	dist += a->radius + b->radius;
+	if (dist == 0.0F)
+		return;
+	dir.x /= dist;
+	dir.y /= dist;
+	s = surface_vel(g, c, dir) - dot(a->vel, dir);
+	if (s <= 0.0F)
+		return;
+	a->vel.x += dir.x * s;
+	a->vel.y += dir.y * s;
+	a->pos.x = p.x + a->vel.x * (1.0F - t) * dt;
+	a->pos.y = p.y + a->vel.y * (1.0F - t) * dt;
+}
+
+static void ball_flipper(int i, int j) {
+	const struct flipper_geom *g;
+	const struct ball *a;
 	struct vec2 pos, dir;
-	float s, corr;
+	float s;
 
-	pos = closest_pos(a->pos, b->pos, get_tip(b));
+	a = &world.balls[i];
+	g = &geom[j];
+	dir = vec2_sub(a->pos, g->pos);
+	s = g->bound + a->radius;
+	if (dot(dir, dir) > s * s)
+		return;
+	s = clamp((dot(a->pos, g->ab) - g->a_ab) * g->inv_ab2, 0.0F, 1.0F);
+	pos.x = g->pos.x + g->ab.x * s;
+	pos.y = g->pos.y + g->ab.y * s;
 	dir = vec2_sub(a->pos, pos);
 	s = sqrtf(dot(dir, dir));
-	if (s == 0.0F || s > a->radius + b->radius)
+	if (s == 0.0F || s > a->radius + g->radius)
 		return;
 	dir.x /= s;
 	dir.y /= s;
-	corr = a->radius + b->radius - s;
-	a->pos.x += dir.x * corr;
-	a->pos.y += dir.y * corr;
-	pos.x = (pos.x + dir.x * b->radius - b->pos.x) * b->cur_wvel;
-	pos.y = (pos.y + dir.y * b->radius - b->pos.y) * b->cur_wvel; 
-	pos = perp(pos);
-	s = dot(pos, dir) - dot(a->vel, dir);
-	a->vel.x += dir.x * s;
-	a->vel.y += dir.y * s;
+	contact_add(i, -1, FEATURE(FEATURE_FLIPPER, j), dir,
+			a->radius + g->radius - s, surface_vel(g, pos, dir));
 }
 
-void simulate(void) {
+void save_state(struct world *w) {
+	memcpy(w, &world, sizeof(world));
+}
+
+void load_state(const struct world *w) {
+	memcpy(&world, w, sizeof(world));
+}
+
+const struct kernel generic_kernel = {
+	0,
+	ball_obstacles,
+	bvh_border
+};
+
+static void sort_bounds(void) {
+	int i;
+
+	sort_lo.x = sort_lo.y = INFINITY;
+	for (i = 0; i < table.n_border; i++) {
+		sort_lo.x = fminf(sort_lo.x, table.border[i].x);
+		sort_lo.y = fminf(sort_lo.y, table.border[i].y);
+	}
+}
+
+void init_table(void) {
+	const struct kernel *const *k;
+	uint64_t hash;
+
+	bvh_build(&table);
+	fix_init();
+	sort_bounds();
+	hash = table_hash(&table);
+	table.kernel = NULL;
+	for (k = kernels; *k; k++) {
+		if ((*k)->hash == hash)
+			table.kernel = *k;
+	}
+}
+
+static int substeps(void) {
+	const struct ball *b;
+	const struct flipper *f;
+	float travel, min_r;
+	int i, n;
+
+	travel = 0.0F;
+	min_r = INFINITY;
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		travel = fmaxf(travel, sqrtf(dot(b->vel, b->vel)) * DT);
+		min_r = fminf(min_r, b->radius);
+	}
+	for (i = 0; i < N_FLIPPERS; i++) {
+		f = &world.flippers[i];
+		if (f->touch_id < 0 ? f->rot > 0.0F : f->rot < f->max_rot)
+			travel = fmaxf(travel, f->wvel * DT * f->length);
+	}
+	n = ceilf(travel / (min_r * SUBSTEP_TRAVEL));
+	return n < 1 ? 1 : n > max_substeps ? max_substeps : n;
+}
+
+static void move(void *arg, int c) {
+	struct ball *b;
+	float dt;
+	int i, j;
+
+	dt = *(float *) arg;
+	for (i = c * MOVE_CHUNK; i < N_BALLS && i < (c + 1) * MOVE_CHUNK; i++) {
+		b = &world.balls[i];
+		if (b->sleep)
+			continue;
+		step_start[i] = b->pos;
+		b->vel.x += gravity.x * dt;
+		b->vel.y += gravity.y * dt;
+		advance(b, dt);
+		for (j = 0; j < N_FLIPPERS; j++)
+			sweep_flipper(b, &world.flippers[j], &geom[j],
+					step_start[i], dt);
+	}
+}
+
+static int find(int i) {
+	while (island[i] != i)
+		i = island[i] = island[island[i]];
+	return i;
+}
+
+static void wake_near(const struct flipper_geom *g) {
+	struct ball *b;
+	struct vec2 d;
+	float r;
+	int i;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		d = vec2_sub(b->pos, g->pos);
+		r = g->bound + b->radius;
+		if (dot(d, d) <= r * r)
+			wake(i);
+	}
+}
+
+static void sleep_islands(float dt) {
+	const struct contact *c, *end;
+	struct ball *b;
+	struct vec2 d;
+	int i, r;
+
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		island[i] = i;
+		island_idle[i] = INFINITY;
+		if (b->sleep)
+			continue;
+		world.ring[i] = i;
+		d = vec2_sub(b->pos, step_start[i]);
+		b->idle = dot(d, d) < SLEEP_VEL * SLEEP_VEL * dt * dt ?
+			b->idle + dt : 0.0F;
+	}
+	end = contact_list() + contact_count();
+	for (c = contact_list(); c < end; c++) {
+		if (c->b >= 0)
+			island[find(c->a)] = find(c->b);
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		island_idle[find(i)] = fminf(island_idle[find(i)],
+				b->sleep ? SLEEP_TIME : b->idle);
+	}
+	for (i = 0; i < N_BALLS; i++) {
+		b = &world.balls[i];
+		if (b->sleep || island_idle[find(i)] < SLEEP_TIME)
+			continue;
+		b->sleep = 1;
+		b->vel.x = 0.0F;
+		b->vel.y = 0.0F;
+		r = find(i);
+		if (r == i)
+			continue;
+		world.ring[i] = world.ring[r];
+		world.ring[r] = i;
+	}
+}
+
+static uint32_t spread(uint32_t v) {
+	v = (v | v << 8) & 0x00FF00FF;
+	v = (v | v << 4) & 0x0F0F0F0F;
+	v = (v | v << 2) & 0x33333333;
+	v = (v | v << 1) & 0x55555555;
+	return v;
+}
+
+static uint32_t cell_of(float v, float lo, float scale) {
+	return clamp((v - lo) * scale, 0.0F, MORTON_MAX);
+}
+
+static uint32_t morton(struct vec2 p, float scale) {
+	return spread(cell_of(p.x, sort_lo.x, scale)) |
+		spread(cell_of(p.y, sort_lo.y, scale)) << 1;
+}
+
+static int cmp_code(const void *a, const void *b) {
+	int i, j;
+
+	i = *(const int *) a;
+	j = *(const int *) b;
+	if (codes[i] != codes[j])
+		return codes[i] < codes[j] ? -1 : 1;
+	return i - j;
+}
+
+static float max_radius(void) {
+	float r;
+	int i;
+
+	r = 0.0F;
+	for (i = 0; i < N_BALLS; i++)
+		r = fmaxf(r, world.balls[i].radius);
+	return r;
+}
+
+static void add_pair(int i, int j) {
+	if (n_pairs == pair_cap) {
+		pair_cap = pair_cap ? pair_cap * 2 : 64;
+		pairs = realloc(pairs, pair_cap * sizeof(*pairs));
+		if (!pairs)
+			die("realloc: out of memory\n");
+	}
+	pairs[n_pairs++] = (uint64_t) i << 32 | j;
+}
+
+static int cmp_pair(const void *a, const void *b) {
+	uint64_t p, q;
+
+	p = *(const uint64_t *) a;
+	q = *(const uint64_t *) b;
+	return p < q ? -1 : p > q;
+}
+
+static void ball_pairs(void) {
+	float scale;
+	uint32_t lo, hi;
+	long y;
+	int i, j, k, m, dy, row[3];
+
+	scale = CELL_SCALE / max_radius();
+	for (i = 0; i < N_BALLS; i++) {
+		cell_x[i] = cell_of(world.balls[i].pos.x, sort_lo.x, scale);
+		cell_y[i] = cell_of(world.balls[i].pos.y, sort_lo.y, scale);
+		codes[i] = cell_y[i] << 16 | cell_x[i];
+		order[i] = i;
+	}
+	qsort(order, N_BALLS, sizeof(*order), cmp_code);
+	row[0] = row[1] = row[2] = 0;
+	n_pairs = 0;
+	for (k = 0; k < N_BALLS; k++) {
+		i = order[k];
+		for (dy = -1; dy <= 1; dy++) {
+			y = (long) cell_y[i] + dy;
+			if (y < 0 || y > MORTON_MAX)
+				continue;
+			lo = y << 16 | (cell_x[i] ? cell_x[i] - 1 : 0);
+			hi = y << 16 | (cell_x[i] < MORTON_MAX ? cell_x[i] + 1 :
+				cell_x[i]);
+			m = row[dy + 1];
+			while (m < N_BALLS && codes[order[m]] < lo)
+				m++;
+			row[dy + 1] = m;
+			for (; m < N_BALLS && codes[order[m]] <= hi; m++) {
+				j = order[m];
+				if (i < j)
+					add_pair(i, j);
+			}
+		}
+	}
+	qsort(pairs, n_pairs, sizeof(*pairs), cmp_pair);
+	for (k = 0; k < n_pairs; k++)
+		ball_ball(pairs[k] >> 32, pairs[k] & 0xFFFFFFFF);
+}
+
+static void step(const struct kernel *k, float dt) {
 	int i, j;
 	struct ball *b;
 	struct flipper *f;
 	float prev_rot;
 
 	for (i = 0; i < N_FLIPPERS; i++) {
-		f = &flippers[i];
+		f = &world.flippers[i];
 		prev_rot = f->rot;
 		f->rot = f->touch_id < 0 ? 
-			fmaxf(f->rot - DT * f->wvel, 0.0F) :
-			fminf(f->rot + DT * f->wvel, f->max_rot);
-		f->cur_wvel = f->sign * (prev_rot - f->rot) / DT;
+			fmaxf(f->rot - dt * f->wvel, 0.0F) :
+			fminf(f->rot + dt * f->wvel, f->max_rot);
+		f->cur_wvel = f->sign * (prev_rot - f->rot) / dt;
+		update_geom(&geom[i], f);
+		if (f->cur_wvel != 0.0F)
+			wake_near(&geom[i]);
 	}
+	pool_run(move, &dt, (N_BALLS + MOVE_CHUNK - 1) / MOVE_CHUNK);
+	contact_begin();
+	ball_pairs();
 	for (i = 0; i < N_BALLS; i++) {
-		b = &balls[i];
-		b->vel.x += gravity.x * DT;
-		b->vel.y += gravity.y * DT;
-		b->pos.x += b->vel.x * DT;
-		b->pos.y += b->vel.y * DT;
-		for (j = i + 1; j < N_BALLS; j++) 
-			ball_ball(b, &balls[j]);
-		for (j = 0; j < N_OBSTACLES; j++)
-			ball_obstacle(b, &obstacles[j]);
+		b = &world.balls[i];
+		if (b->sleep)
+			continue;
+		k->obstacles(b, i);
 		for (j = 0; j < N_FLIPPERS; j++)
-			ball_flipper(b, &flippers[j]);
-		ball_border(b);
+			ball_flipper(i, j);
+		k->border(b, i, dt);
+	}
+	contact_solve();
+	sleep_islands(dt);
+}
+
+static void sort_balls(void) {
+	float scale;
+	int i, n;
+
+	scale = 0.5F / max_radius();
+	codes[0] = morton(world.balls[0].pos, scale);
+	n = 0;
+	for (i = 1; i < N_BALLS; i++) {
+		codes[i] = morton(world.balls[i].pos, scale);
+		n += codes[i - 1] >> SORT_BLOCK_BITS > codes[i] >> SORT_BLOCK_BITS;
+	}
+	if (n <= SORT_DISORDER * (N_BALLS - 1))
+		return;
+	for (i = 0; i < N_BALLS; i++)
+		order[i] = i;
+	qsort(order, N_BALLS, sizeof(*order), cmp_code);
+	for (i = 0; i < N_BALLS; i++) {
+		sorted[i] = world.balls[order[i]];
+		index_of[order[i]] = i;
+	}
+	for (i = 0; i < N_BALLS; i++)
+		sorted_ring[i] = index_of[world.ring[order[i]]];
+	memcpy(world.balls, sorted, sizeof(sorted));
+	memcpy(world.ring, sorted_ring, sizeof(sorted_ring));
+	for (i = 0; i < N_BALLS; i++)
+		world.slot[i] = index_of[world.slot[i]];
+	contact_remap(index_of);
+	world.sorts++;
+}
+
+void simulate_kernel(const struct kernel *k) {
+	int i, n;
+
+	n = substeps();
+	for (i = 0; i < n; i++)
+		step(k, DT / n);
+	if (sort_interval > 0 && ++world.since_sort >= sort_interval) {
+		world.since_sort = 0;
+		sort_balls();
+	}
+}
+
+void simulate(void) {
+	if (fixed_mode) {
+		fix_simulate();
+		return;
 	}
+	simulate_kernel(table.kernel ? table.kernel : &generic_kernel);
 }
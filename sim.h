@@ -1,12 +1,13 @@
 #ifndef BALL_H
 #define BALL_H
 
+#include <stdint.h>
+
 #define N_BALLS 2
-#define N_BORDER 8
-#define N_OBSTACLES 4
 #define N_FLIPPERS 2
 #define FPS 60
 #define DT (1.0F / FPS)
+#define MAX_WARM (N_BALLS * 8)
 
 struct vec2 {
 	float x;
@@ -19,6 +20,8 @@ struct ball {
 	struct vec2 pos;
 	struct vec2 vel;
 	float restitution;
+	float idle;
+	int sleep;
 };
 
 struct obstacle {
@@ -40,12 +43,60 @@ struct flipper {
 	float touch_id;
 };
 
-extern struct ball balls[];
-extern struct vec2 border[];
-extern struct obstacle obstacles[];
-extern struct flipper flippers[];
+struct warm {
+	int a;
+	int b;
+	int feature;
+	float impulse;
+};
+
+struct world {
+	struct ball balls[N_BALLS];
+	struct flipper flippers[N_FLIPPERS];
+	int slot[N_BALLS];
+	int since_sort;
+	uint32_t sorts;
+	struct warm warm[MAX_WARM];
+	int n_warm;
+	int ring[N_BALLS];
+};
+
+struct polyline {
+	int first;
+	int n;
+	int closed;
+};
+
+struct kernel {
+	uint64_t hash;
+	void (*obstacles)(const struct ball *b, int i);
+	void (*border)(const struct ball *b, int i, float dt);
+};
+
+struct table {
+	int n_border;
+	int n_lines;
+	int n_obstacles;
+	const struct vec2 *border;
+	const struct polyline *lines;
+	const struct obstacle *obstacles;
+	const struct kernel *kernel;
+};
+
+extern struct world world;
+extern struct table table;
+extern int max_substeps;
+extern int sort_interval;
+extern int fixed_mode;
+extern const struct vec2 gravity;
+extern const struct kernel generic_kernel;
+extern const struct kernel *const kernels[];
 
 void init_balls(void); 
+void save_state(struct world *w);
+void load_state(const struct world *w);
+void init_table(void);
+void simulate_kernel(const struct kernel *k);
 void simulate(void);
 
 #endif
@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "draw.h"
+#include "sim.h"
+#include "table.h"
+
+static int check_array(const struct table_header *h, uint32_t off,
+		uint32_t n, size_t size) {
+	return off % TABLE_ALIGN == 0 && off >= sizeof(*h) &&
+		off <= h->size && n <= (h->size - off) / size;
+}
+
+static int finite_floats(const void *p, size_t size) {
+	const float *f;
+	size_t i;
+
+	f = p;
+	for (i = 0; i < size / sizeof(float); i++) {
+		if (!isfinite(f[i]))
+			return 0;
+	}
+	return 1;
+}
+
+void load_table(const char *path) {
+	const struct table_header *h;
+	const struct polyline *l;
+	const struct obstacle *o;
+	const struct flipper *f;
+	struct stat st;
+	void *p;
+	uint32_t i;
+	int fd, j;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die("open: %s: %s\n", path, strerror(errno));
+	if (fstat(fd, &st) < 0)
+		die("fstat: %s: %s\n", path, strerror(errno));
+	if ((size_t) st.st_size < sizeof(*h))
+		die("%s: truncated table\n", path);
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		die("mmap: %s: %s\n", path, strerror(errno));
+	close(fd);
+	h = p;
+	if (h->magic != TABLE_MAGIC || h->endian != TABLE_ENDIAN)
+		die("%s: not a table\n", path);
+	if (h->version != TABLE_VERSION)
+		die("%s: table version %u, expected %u\n", path,
+				h->version, TABLE_VERSION);
+	if (h->size != st.st_size ||
+			h->vec2_size != sizeof(struct vec2) ||
+			h->obstacle_size != sizeof(struct obstacle) ||
+			h->flipper_size != sizeof(struct flipper) ||
+			h->polyline_size != sizeof(struct polyline))
+		die("%s: table layout mismatch\n", path);
+	if (h->n_border < 2 || h->n_lines < 1 ||
+			h->n_flippers != N_FLIPPERS ||
+			h->n_border > MAX_TABLE_ITEMS ||
+			h->n_lines > MAX_TABLE_ITEMS ||
+			h->n_obstacles > MAX_TABLE_ITEMS ||
+			!check_array(h, h->border_off, h->n_border,
+				sizeof(struct vec2)) ||
+			!check_array(h, h->lines_off, h->n_lines,
+				sizeof(struct polyline)) ||
+			!check_array(h, h->obstacles_off, h->n_obstacles,
+				sizeof(struct obstacle)) ||
+			!check_array(h, h->flippers_off, h->n_flippers,
+				sizeof(struct flipper)))
+		die("%s: bad table counts\n", path);
+	table.n_border = h->n_border;
+	table.n_lines = h->n_lines;
+	table.n_obstacles = h->n_obstacles;
+	table.border = (const struct vec2 *) ((char *) p + h->border_off);
+	table.lines = (const struct polyline *) ((char *) p + h->lines_off);
+	table.obstacles = (const struct obstacle *)
+		((char *) p + h->obstacles_off);
+	f = (const struct flipper *) ((char *) p + h->flippers_off);
+	if (!finite_floats(table.border, h->n_border * sizeof(struct vec2)) ||
+			!finite_floats(table.obstacles,
+				h->n_obstacles * sizeof(*o)) ||
+			!finite_floats(f, h->n_flippers * sizeof(*f)))
+		die("%s: non-finite table values\n", path);
+	for (i = 0; i < h->n_lines; i++) {
+		l = &table.lines[i];
+		if (l->first < 0 || l->n < (l->closed ? 3 : 2) ||
+				l->n > table.n_border - l->first)
+			die("%s: polyline %u: bad range\n", path, i);
+		if ((j = short_segment(table.border, l)) >= 0)
+			die("%s: polyline %u: segment %d too short\n",
+					path, i, j);
+	}
+	for (i = 0; i < h->n_obstacles; i++) {
+		o = &table.obstacles[i];
+		if (o->radius <= 0.0F)
+			die("%s: obstacle %u: bad radius\n", path, i);
+	}
+	for (i = 0; i < h->n_flippers; i++) {
+		if (f[i].radius <= 0.0F || f[i].length <= 0.0F)
+			die("%s: flipper %u: bad size\n", path, i);
+	}
+	memcpy(world.flippers, f, sizeof(world.flippers));
+}
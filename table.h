@@ -0,0 +1,75 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sim.h"
+
+#define TABLE_MAGIC 0x4C425450
+#define TABLE_VERSION 2
+#define TABLE_ENDIAN 0x01020304
+#define TABLE_ALIGN 16
+#define MAX_TABLE_ITEMS 65536
+#define MIN_SEGMENT 1e-4F
+
+struct table_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t endian;
+	uint32_t size;
+	uint16_t vec2_size;
+	uint16_t obstacle_size;
+	uint16_t flipper_size;
+	uint16_t polyline_size;
+	uint32_t n_border;
+	uint32_t n_lines;
+	uint32_t n_obstacles;
+	uint32_t n_flippers;
+	uint32_t border_off;
+	uint32_t lines_off;
+	uint32_t obstacles_off;
+	uint32_t flippers_off;
+};
+
+static inline uint64_t hash_bytes(uint64_t h, const void *p, size_t n) {
+	const unsigned char *c;
+
+	for (c = p; n--; c++) {
+		h ^= *c;
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+static inline uint64_t table_hash(const struct table *t) {
+	uint64_t h;
+
+	h = 0xCBF29CE484222325ULL;
+	h = hash_bytes(h, &t->n_border, sizeof(t->n_border));
+	h = hash_bytes(h, &t->n_lines, sizeof(t->n_lines));
+	h = hash_bytes(h, &t->n_obstacles, sizeof(t->n_obstacles));
+	h = hash_bytes(h, t->border, t->n_border * sizeof(*t->border));
+	h = hash_bytes(h, t->lines, t->n_lines * sizeof(*t->lines));
+	return hash_bytes(h, t->obstacles,
+			t->n_obstacles * sizeof(*t->obstacles));
+}
+
+static inline int short_segment(const struct vec2 *v,
+		const struct polyline *l) {
+	struct vec2 a, b;
+	int i, n;
+
+	n = l->closed ? l->n : l->n - 1;
+	for (i = 0; i < n; i++) {
+		a = v[l->first + i];
+		b = v[l->first + (i + 1) % l->n];
+		if ((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y) <
+				MIN_SEGMENT * MIN_SEGMENT)
+			return i;
+	}
+	return -1;
+}
+
+void load_table(const char *path);
+
+#endif
@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "draw.h"
+#include "kern.h"
+#include "sim.h"
+#include "table.h"
+
+#define MAX_LINE 256
+#define MAX_FLOAT 32
+#define MAX_UNROLL 64
+
+struct source {
+	struct table_header h;
+	struct vec2 *border;
+	struct polyline *lines;
+	struct obstacle *obstacles;
+	struct flipper *flippers;
+};
+
+static void *grow(void *p, uint32_t n, size_t size) {
+	if (n >= MAX_TABLE_ITEMS)
+		die("table: too many items\n");
+	if (n & (n - 1))
+		return p;
+	p = realloc(p, (n ? n * 2 : 1) * size);
+	if (!p)
+		die("realloc: out of memory\n");
+	return p;
+}
+
+static uint32_t align(uint32_t off) {
+	return (off + TABLE_ALIGN - 1) & ~(TABLE_ALIGN - 1);
+}
+
+static void add_line(struct source *s, int closed) {
+	struct polyline *l;
+
+	s->lines = grow(s->lines, s->h.n_lines, sizeof(*s->lines));
+	l = &s->lines[s->h.n_lines++];
+	l->first = s->h.n_border;
+	l->n = 0;
+	l->closed = closed;
+}
+
+static void parse_table(struct source *s, FILE *in, const char *name) {
+	struct vec2 *v;
+	struct polyline *l;
+	struct obstacle *o;
+	struct flipper *fl;
+	char line[MAX_LINE], kw[MAX_LINE];
+	int n, ln;
+
+	memset(s, 0, sizeof(*s));
+	for (ln = 1; fgets(line, sizeof(line), in); ln++) {
+		if (sscanf(line, "%s%n", kw, &n) != 1 || kw[0] == '#')
+			continue;
+		if (!strcmp(kw, "loop") || !strcmp(kw, "wall")) {
+			add_line(s, kw[0] == 'l');
+		} else if (!strcmp(kw, "border")) {
+			if (!s->h.n_lines)
+				add_line(s, 1);
+			s->lines[s->h.n_lines - 1].n++;
+			s->border = grow(s->border, s->h.n_border,
+					sizeof(*s->border));
+			v = &s->border[s->h.n_border++];
+			if (sscanf(line + n, "%f %f", &v->x, &v->y) != 2)
+				die("%s:%d: border x y\n", name, ln);
+		} else if (!strcmp(kw, "obstacle")) {
+			s->obstacles = grow(s->obstacles, s->h.n_obstacles,
+					sizeof(*s->obstacles));
+			o = &s->obstacles[s->h.n_obstacles++];
+			if (sscanf(line + n, "%f %f %f %f", &o->radius,
+					&o->pos.x, &o->pos.y,
+					&o->push_vel) != 4)
+				die("%s:%d: obstacle radius x y push_vel\n",
+						name, ln);
+		} else if (!strcmp(kw, "flipper")) {
+			s->flippers = grow(s->flippers, s->h.n_flippers,
+					sizeof(*s->flippers));
+			fl = &s->flippers[s->h.n_flippers++];
+			memset(fl, 0, sizeof(*fl));
+			fl->touch_id = -1.0F;
+			if (sscanf(line + n, "%f %f %f %f %f %f %f %f",
+					&fl->radius, &fl->pos.x, &fl->pos.y,
+					&fl->length, &fl->rest_rad,
+					&fl->max_rot, &fl->sign,
+					&fl->wvel) != 8)
+				die("%s:%d: flipper radius x y length "
+					"rest_rad max_rot sign wvel\n",
+					name, ln);
+		} else {
+			die("%s:%d: unknown item %s\n", name, ln, kw);
+		}
+	}
+	if (ferror(in))
+		die("%s: read failed\n", name);
+	if (!s->h.n_lines)
+		die("%s: no border\n", name);
+	for (l = s->lines; l < s->lines + s->h.n_lines; l++) {
+		if (l->n < (l->closed ? 3 : 2))
+			die("%s: %s needs at least %d points\n", name,
+					l->closed ? "loop" : "wall",
+					l->closed ? 3 : 2);
+		if ((n = short_segment(s->border, l)) >= 0)
+			die("%s: %s %d: segment %d shorter than %g\n", name,
+					l->closed ? "loop" : "wall",
+					(int) (l - s->lines), n, MIN_SEGMENT);
+	}
+}
+
+static void write_at(FILE *f, uint32_t off, const void *p, size_t size,
+		const char *out) {
+	if (fseek(f, off, SEEK_SET) || fwrite(p, 1, size, f) != size)
+		die("%s: write failed\n", out);
+}
+
+static void write_table(struct source *s, const char *out) {
+	struct table_header *h;
+	FILE *f;
+
+	h = &s->h;
+	h->magic = TABLE_MAGIC;
+	h->version = TABLE_VERSION;
+	h->endian = TABLE_ENDIAN;
+	h->vec2_size = sizeof(struct vec2);
+	h->obstacle_size = sizeof(struct obstacle);
+	h->flipper_size = sizeof(struct flipper);
+	h->polyline_size = sizeof(struct polyline);
+	h->border_off = align(sizeof(*h));
+	h->lines_off = align(h->border_off +
+			h->n_border * sizeof(*s->border));
+	h->obstacles_off = align(h->lines_off +
+			h->n_lines * sizeof(*s->lines));
+	h->flippers_off = align(h->obstacles_off +
+			h->n_obstacles * sizeof(*s->obstacles));
+	h->size = align(h->flippers_off +
+			h->n_flippers * sizeof(*s->flippers));
+	f = fopen(out, "wb");
+	if (!f)
+		die("fopen: %s: %s\n", out, strerror(errno));
+	write_at(f, 0, h, sizeof(*h), out);
+	write_at(f, h->border_off, s->border,
+			h->n_border * sizeof(*s->border), out);
+	write_at(f, h->lines_off, s->lines,
+			h->n_lines * sizeof(*s->lines), out);
+	write_at(f, h->obstacles_off, s->obstacles,
+			h->n_obstacles * sizeof(*s->obstacles), out);
+	write_at(f, h->flippers_off, s->flippers,
+			h->n_flippers * sizeof(*s->flippers), out);
+	if (fseek(f, h->size - 1, SEEK_SET) || fputc(0, f) == EOF)
+		die("%s: write failed\n", out);
+	if (fclose(f))
+		die("%s: write failed\n", out);
+}
+
+static const char *lit(char *buf, float v) {
+	snprintf(buf, MAX_FLOAT, "%.9g", v);
+	if (!strpbrk(buf, ".en"))
+		strcat(buf, ".0");
+	strcat(buf, "F");
+	return buf;
+}
+
+static void emit_segments(struct source *s, const char *name, FILE *f) {
+	const struct polyline *l;
+	struct segment seg;
+	char b[8][MAX_FLOAT];
+	int i, n;
+
+	fprintf(f, "static const struct segment segs_%s[] = {\n", name);
+	n = 0;
+	for (l = s->lines; l < s->lines + s->h.n_lines; l++) {
+		for (i = 0; i < line_segments(l); i++) {
+			make_segment(&seg, s->border, l, i, n++);
+			fprintf(f, "\t{{%s, %s}, {%s, %s}, %s, %s, %d, %d, "
+					"{%s, %s}, %d},\n",
+					lit(b[0], seg.a.x), lit(b[1], seg.a.y),
+					lit(b[2], seg.ab.x), lit(b[3], seg.ab.y),
+					lit(b[4], seg.a_ab), lit(b[5], seg.ab2),
+					seg.id, seg.sided, lit(b[6], seg.prev_ab.x),
+					lit(b[7], seg.prev_ab.y), seg.open_end);
+		}
+	}
+	fprintf(f, "};\n\n");
+	fprintf(f, "static void border_%s(const struct ball *b, int i,\n\t\tfloat dt) {\n", name);
+	fprintf(f, "\tfloat reach2;\n\n\treach2 = border_reach(b, dt);\n");
+	for (i = 0; i < n; i++)
+		fprintf(f, "\tseg_border(b, i, reach2, &segs_%s[%d]);\n",
+				name, i);
+	fprintf(f, "}\n\n");
+}
+
+static void emit_kernel(struct source *s, const char *name,
+		const char *src, const char *out) {
+	struct table t;
+	const struct polyline *l;
+	const struct obstacle *o;
+	char b[4][MAX_FLOAT];
+	uint32_t i;
+	int n;
+	FILE *f;
+
+	f = fopen(out, "w");
+	if (!f)
+		die("fopen: %s: %s\n", out, strerror(errno));
+	fprintf(f, "/* Generated by tblc from %s. Do not edit. */\n", src);
+	fprintf(f, "#include \"bvh.h\"\n#include \"kern.h\"\n\n");
+	fprintf(f, "static void obstacles_%s(const struct ball *b, int i) {\n", name);
+	for (i = 0; i < s->h.n_obstacles; i++) {
+		o = &s->obstacles[i];
+		fprintf(f, "\tobstacle_hit(b, i, %u, %s, %s, %s, %s);\n",
+				i, lit(b[0], o->radius), lit(b[1], o->pos.x),
+				lit(b[2], o->pos.y), lit(b[3], o->push_vel));
+	}
+	fprintf(f, "}\n\n");
+	n = 0;
+	for (l = s->lines; l < s->lines + s->h.n_lines; l++)
+		n += line_segments(l);
+	if (n <= MAX_UNROLL)
+		emit_segments(s, name, f);
+	t.n_border = s->h.n_border;
+	t.n_lines = s->h.n_lines;
+	t.n_obstacles = s->h.n_obstacles;
+	t.border = s->border;
+	t.lines = s->lines;
+	t.obstacles = s->obstacles;
+	fprintf(f, "const struct kernel kernel_%s = {\n", name);
+	fprintf(f, "\t0x%016llXULL,\n", (unsigned long long) table_hash(&t));
+	fprintf(f, "\tobstacles_%s,\n", name);
+	if (n <= MAX_UNROLL)
+		fprintf(f, "\tborder_%s\n};\n", name);
+	else
+		fprintf(f, "\tbvh_border\n};\n");
+	if (fclose(f))
+		die("%s: write failed\n", out);
+}
+
+int main(int argc, char **argv) {
+	struct source s;
+	const char *name;
+	FILE *in;
+
+	name = NULL;
+	if (argc == 5 && !strcmp(argv[1], "-c")) {
+		name = argv[2];
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc != 3)
+		die("usage: %s [-c name] table.tbl out\n", argv[0]);
+	in = fopen(argv[1], "r");
+	if (!in)
+		die("fopen: %s\n", argv[1]);
+	parse_table(&s, in, argv[1]);
+	fclose(in);
+	if (name)
+		emit_kernel(&s, name, argv[1], argv[2]);
+	else
+		write_table(&s, argv[2]);
+	free(s.border);
+	free(s.lines);
+	free(s.obstacles);
+	free(s.flippers);
+	return 0;
+}
@@ -4,14 +4,38 @@
 #include <libavformat/avformat.h>
 #include <libavutil/opt.h>
 #include <libswscale/swscale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "draw.h"
+#include "replay.h"
 #include "sim.h"
+#include "table.h"
 
 #define WIDTH 640
 #define HEIGHT 480
+#define MAX_PATH 4096
+
+struct key {
+	struct world w;
+	struct replay_mark m;
+	long tick;
+};
 
 static uint8_t pixels[WIDTH * HEIGHT * 3];
-static const char path[] = "ball.mp4";
+static const char *path = "ball.mp4";
+static const char *replay_path;
+static const AVOutputFormat *outfmt;
+static struct key *keys;
+static int n_keys;
+static long n_ticks;
+
+static void chunk_path(char *p, int c) {
+	if (snprintf(p, MAX_PATH, "%s.%d", path, c) >= MAX_PATH)
+		die("chunk_path: path too long\n");
+}
 
 static void encode(AVCodecContext *cctx, AVFrame *frame,
 	       AVPacket *pkt, AVFormatContext *fmtctx, AVStream *vid) {
@@ -22,7 +46,7 @@ static void encode(AVCodecContext *cctx, AVFrame *frame,
 		die("avcodec_send_frame: %s\n", av_err2str(ret));
 	while (ret >= 0) {
 		ret = avcodec_receive_packet(cctx, pkt);
-		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) 
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
 			return;
 		if (ret < 0)
 			die("avcodec_receive_packet: %s\n", ret);
@@ -30,13 +54,39 @@ static void encode(AVCodecContext *cctx, AVFrame *frame,
 		av_write_frame(fmtctx, pkt);
 		av_packet_unref(pkt);
 	}
-}	
+}
+
+static void sim_pass(long limit, long key_ticks) {
+	struct key *k;
+	long t;
 
-static void render(void) {
+	if (replay_path)
+		replay_open(replay_path);
+	for (t = 0; replay_path || t < limit; t++) {
+		if (t % key_ticks == 0) {
+			keys = realloc(keys, (n_keys + 1) * sizeof(*keys));
+			if (!keys)
+				die("realloc: out of memory\n");
+			k = &keys[n_keys++];
+			save_state(&k->w);
+			if (replay_path)
+				replay_mark(&k->m);
+			k->tick = t;
+		}
+		if (replay_path && !replay_next()) {
+			if (t % key_ticks == 0)
+				n_keys--;
+			break;
+		}
+		simulate();
+	}
+	n_ticks = t;
+}
+
+static void render_chunk(int c) {
 	struct SwsContext *sws;
 	const uint8_t *src;
 	int src_stride;
-	const AVOutputFormat *outfmt;
 	AVFormatContext *fmtctx;
 	int ret;
 	const AVCodec *codec;
@@ -44,7 +94,8 @@ static void render(void) {
 	AVCodecContext *cctx;
 	AVPacket *pkt;
 	AVFrame *frame;
-	int i;
+	char p[MAX_PATH];
+	long i, end;
 
 	sws = sws_getContext(WIDTH, HEIGHT, AV_PIX_FMT_RGB24,
 		WIDTH, HEIGHT, AV_PIX_FMT_YUV420P, 0,
@@ -53,12 +104,10 @@ static void render(void) {
 		die("sws_getContext\n");
 	src = pixels + WIDTH * 3 * (HEIGHT - 1);
 	src_stride = -WIDTH * 3;
-	outfmt = av_guess_format(NULL, path, NULL);
-	if (!outfmt)
-		die("av_guess_format\n");
-	ret = avformat_alloc_output_context2(&fmtctx, outfmt, NULL, path);
+	chunk_path(p, c);
+	ret = avformat_alloc_output_context2(&fmtctx, outfmt, NULL, p);
 	if (ret < 0)
-		die("avformat_free_context: %s\n", av_err2str(ret));
+		die("avformat_alloc_output_context2: %s\n", av_err2str(ret));
 	codec = avcodec_find_encoder(outfmt->video_codec);
 	if (!codec)
 		die("avcodec_find_encoder\n");
@@ -76,17 +125,20 @@ static void render(void) {
 	vid->codecpar->bit_rate = 200000;
         av_opt_set(cctx, "preset", "ultrafast", 0);
 	avcodec_parameters_to_context(cctx, vid->codecpar);
-	cctx->time_base.num = 1; 
-	cctx->time_base.den = FPS; 
-	cctx->framerate.num = FPS; 
-	cctx->framerate.den = 1; 
+	cctx->time_base.num = 1;
+	cctx->time_base.den = FPS;
+	cctx->framerate.num = FPS;
+	cctx->framerate.den = 1;
 	cctx->gop_size = FPS * 10;
-	cctx->max_b_frames = 1;
-	avcodec_parameters_from_context(vid->codecpar, cctx);
+	cctx->max_b_frames = 0;
+	cctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+	if (outfmt->flags & AVFMT_GLOBALHEADER)
+		cctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 	ret = avcodec_open2(cctx, codec, NULL);
 	if (ret < 0)
 		die("avcodec_open2: %s\n", av_err2str(ret));
-	ret = avio_open(&fmtctx->pb, path, AVIO_FLAG_WRITE);
+	avcodec_parameters_from_context(vid->codecpar, cctx);
+	ret = avio_open(&fmtctx->pb, p, AVIO_FLAG_WRITE);
 	if (ret < 0)
 		die("avio_open: %s\n", av_err2str(ret));
     	ret = avformat_write_header(fmtctx, NULL);
@@ -98,50 +150,61 @@ static void render(void) {
 	frame = av_frame_alloc();
 	if (!frame)
 		die("av_frame_alloc\n");
-	frame->format = AV_PIX_FMT_YUV420P;	
+	frame->format = AV_PIX_FMT_YUV420P;
 	frame->width = WIDTH;
 	frame->height = HEIGHT;
 	ret = av_frame_get_buffer(frame, 0);
 	if (ret < 0)
 		die("av_frame_get_buffer: %s\n", av_err2str(ret));
-	for (i = 0; i < FPS * 10; i++) {
+	load_state(&keys[c].w);
+	if (replay_path)
+		replay_resume(&keys[c].m);
+	end = c + 1 < n_keys ? keys[c + 1].tick : n_ticks;
+	for (i = 0; i < end - keys[c].tick; i++) {
 		ret = av_frame_make_writable(frame);
 		if (ret < 0)
 			die("av_frame_make_writable: %s\n", av_err2str(ret));
+		if (replay_path && !replay_next())
+			die("render_chunk: %s: replay ended early\n", p);
 		simulate();
 		draw();
-		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB, 
-				GL_UNSIGNED_BYTE, pixels); 
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGB,
+				GL_UNSIGNED_BYTE, pixels);
 		ret = sws_scale(sws, &src,
-				&src_stride, 0, HEIGHT, 
+				&src_stride, 0, HEIGHT,
 				frame->data, frame->linesize);
 		frame->pts = i;
 		encode(cctx, frame, pkt, fmtctx, vid);
 	}
 	encode(cctx, NULL, pkt, fmtctx, vid);
+	if (c + 1 < n_keys && memcmp(&world, &keys[c + 1].w, sizeof(world)))
+		die("render_chunk: %s: chunk %d ends off the sim pass\n", p, c);
 	av_frame_free(&frame);
 	av_packet_free(&pkt);
 	av_write_trailer(fmtctx);
 	avio_close(fmtctx->pb);
 	avcodec_free_context(&cctx);
 	avformat_free_context(fmtctx);
+	sws_freeContext(sws);
 }
 
-int main(int argc, char **argv) {
+static void render(int worker, int n_workers) {
 	SDL_Window *wnd;
 	GLuint fbo;
 	GLuint tex;
+	int c;
+
 	if (SDL_Init(SDL_INIT_EVERYTHING))
 		die("SDL_Init: %s\n", SDL_GetError());
 	if (atexit(SDL_Quit))
 		die("atexit: SDL_Quit\n");
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, 
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
 			SDL_GL_CONTEXT_PROFILE_CORE);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	wnd = SDL_CreateWindow("Billiards", SDL_WINDOWPOS_UNDEFINED,
-			SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, 
-			SDL_WINDOW_OPENGL);
+			SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT,
+			SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
 	if (!wnd)
 		die("SDL_CreateWindow: %s\n", SDL_GetError());
 	if (!SDL_GL_CreateContext(wnd))
@@ -152,14 +215,141 @@ int main(int argc, char **argv) {
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glGenTextures(1, &tex);
 	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT, 
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH, HEIGHT,
 			0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
 			GL_TEXTURE_2D, tex, 0);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != 
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
 			GL_FRAMEBUFFER_COMPLETE)
 		die("glCheckFramebufferStatus: %u\n", glGetError());
-	render();
+	if (replay_path)
+		replay_open(replay_path);
+	for (c = worker; c < n_keys; c += n_workers)
+		render_chunk(c);
+}
+
+static void concat(void) {
+	AVFormatContext *fmtctx, *in;
+	AVStream *vid, *s;
+	AVPacket *pkt;
+	char p[MAX_PATH];
+	int64_t off;
+	int c, ret;
+
+	ret = avformat_alloc_output_context2(&fmtctx, outfmt, NULL, path);
+	if (ret < 0)
+		die("avformat_alloc_output_context2: %s\n", av_err2str(ret));
+	pkt = av_packet_alloc();
+	if (!pkt)
+		die("av_packet_alloc\n");
+	vid = NULL;
+	for (c = 0; c < n_keys; c++) {
+		chunk_path(p, c);
+		in = NULL;
+		ret = avformat_open_input(&in, p, NULL, NULL);
+		if (ret < 0)
+			die("avformat_open_input: %s: %s\n", p, av_err2str(ret));
+		ret = avformat_find_stream_info(in, NULL);
+		if (ret < 0)
+			die("avformat_find_stream_info: %s\n", av_err2str(ret));
+		s = in->streams[0];
+		if (!vid) {
+			vid = avformat_new_stream(fmtctx, NULL);
+			if (!vid)
+				die("avformat_new_stream\n");
+			avcodec_parameters_copy(vid->codecpar, s->codecpar);
+			vid->codecpar->codec_tag = 0;
+			vid->time_base = s->time_base;
+			ret = avio_open(&fmtctx->pb, path, AVIO_FLAG_WRITE);
+			if (ret < 0)
+				die("avio_open: %s\n", av_err2str(ret));
+			ret = avformat_write_header(fmtctx, NULL);
+			if (ret < 0)
+				die("avformat_write_header: %s\n",
+						av_err2str(ret));
+		}
+		off = av_rescale_q(keys[c].tick, (AVRational) {1, FPS},
+				vid->time_base);
+		while (av_read_frame(in, pkt) >= 0) {
+			av_packet_rescale_ts(pkt, s->time_base, vid->time_base);
+			pkt->pts += off;
+			pkt->dts += off;
+			pkt->stream_index = 0;
+			pkt->pos = -1;
+			ret = av_interleaved_write_frame(fmtctx, pkt);
+			if (ret < 0)
+				die("av_interleaved_write_frame: %s\n",
+						av_err2str(ret));
+		}
+		avformat_close_input(&in);
+		unlink(p);
+	}
+	av_write_trailer(fmtctx);
+	avio_close(fmtctx->pb);
+	avformat_free_context(fmtctx);
+	av_packet_free(&pkt);
+}
+
+int main(int argc, char **argv) {
+	float seconds, key_seconds;
+	int i, opt, n_workers, status;
+	pid_t pid;
+
+	seconds = key_seconds = 10.0F;
+	n_workers = 0;
+	while ((opt = getopt(argc, argv, "t:r:s:k:j:")) != -1) {
+		switch (opt) {
+		case 't':
+			load_table(optarg);
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'k':
+			key_seconds = atof(optarg);
+			if (key_seconds * FPS < 1.0F)
+				die("%s: bad keyframe interval\n", argv[0]);
+			break;
+		case 'j':
+			n_workers = atoi(optarg);
+			break;
+		default:
+			die("usage: %s [-t table.tblb] [-r replay | -s seconds] "
+				"[-k seconds] [-j processes] [path]\n", argv[0]);
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+	if (n_workers <= 0)
+		n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	outfmt = av_guess_format(NULL, path, NULL);
+	if (!outfmt)
+		die("av_guess_format\n");
+	init_table();
+	sim_pass(seconds * FPS, key_seconds * FPS);
+	if (n_keys == 0)
+		die("%s: nothing to render\n", argv[0]);
+	if (n_workers > n_keys)
+		n_workers = n_keys;
+	fflush(NULL);
+	for (i = 0; i < n_workers; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork\n");
+		if (pid == 0) {
+			render(i, n_workers);
+			exit(0);
+		}
+	}
+	for (i = 0; i < n_workers; i++) {
+		if (wait(&status) < 0)
+			die("wait\n");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			die("%s: render worker failed\n", argv[0]);
+	}
+	concat();
 	return 0;
 }